@@ -58,7 +58,7 @@ typedef struct {
     void(*free)(void*);
 } array_allocator_t;
 
-const array_allocator_t array_stdlib_allocator = {
+static const array_allocator_t array_stdlib_allocator = {
     .realloc = &realloc,
     .free    = &free
 };
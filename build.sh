@@ -1,5 +1,8 @@
 #!/bin/sh
 
+# Builds the tlpin executable. Pass `library` to build libtlpin.a and
+# libtlpin.so instead, or `all` for everything.
+
 # Error on unset variables.
 set -u
 
@@ -7,14 +10,34 @@ set -u
 
 CC=${CC:-cc}
 CFLAGS=${CFLAGS:--Wall -Wextra -Wswitch-enum -Wconversion -Werror -pedantic}
+LDFLAGS=${LDFLAGS:--pthread}
+AR=${AR:-ar}
 
 SOURCE=tlpin.c
 EXECUTABLE=${SOURCE%.c}
+LIBRARY=lib${SOURCE%.c}
+
+TARGET=${1:-executable}
+case "$TARGET" in
+    executable|library|all) ;;
+    *) echo "Error: Unknown target '$TARGET'" >&2; exit 1 ;;
+esac
 
 
 
 # Displays commands.
 set -x
 
-# shellcheck disable=SC2086 # We want word spliting.
-"$CC" $CFLAGS "$SOURCE" -o "$EXECUTABLE" || exit 1
+if [ "$TARGET" != library ]; then
+    # shellcheck disable=SC2086 # We want word spliting.
+    "$CC" $CFLAGS "$SOURCE" -o "$EXECUTABLE" $LDFLAGS || exit 1
+fi
+
+if [ "$TARGET" != executable ]; then
+    # shellcheck disable=SC2086 # We want word spliting.
+    "$CC" $CFLAGS -DTLPIN_LIBRARY -fPIC -fvisibility=hidden -c "$SOURCE" -o "$LIBRARY.o" || exit 1
+    "$AR" rcs "$LIBRARY.a" "$LIBRARY.o"                                                  || exit 1
+    # shellcheck disable=SC2086 # We want word spliting.
+    "$CC" -shared "$LIBRARY.o" -o "$LIBRARY.so" $LDFLAGS                                 || exit 1
+    rm "$LIBRARY.o"
+fi
@@ -1,600 +1,331 @@
+/*
+ * Preprocessor parameters:
+ * - TLPIN_NO_JIT - Disables the native code JIT, even on platforms that support
+ *   it.
+ * - JIT_HOT_THRESHOLD - How many times a defun must be called before the JIT
+ *   compiles it. Has default value.
+ * - INLINE_BUDGET - The maximum number of functions a defun's body can have for
+ *   it to be inlined into it's callers. Has default value.
+ * - PARALLEL_THRESHOLD - The minimum number of elements an array needs for
+ *   operators to process it on multiple threads. Has default value.
+ * - PARALLEL_CHUNK_SIZE - How many elements a thread takes at a time when
+ *   processing an array in parallel. Has default value.
+ * - ELEMENTWISE_CHUNK_SIZE - Like PARALLEL_CHUNK_SIZE, but for arithmetic on
+ *   flat arrays, where each element is much cheaper. Has default value.
+ * - REDUCE_BLOCK_SIZE - How many elements are summed in order before the
+ *   partial sums are combined. Changing it changes the rounding of sums, but
+ *   the thread count never does. Has default value.
+ * - SORT_PARALLEL_THRESHOLD - The minimum number of elements an array needs to
+ *   be sorted on multiple threads. Has default value.
+ * - ARENA_BLOCK_SIZE - The size of the blocks programs are allocated from.
+ *   Has default value.
+ * - MEMO_CAPACITY - The maximum number of results kept by the memoization
+ *   cache. Has default value.
+ * - LAZY_BLOCK_SIZE - How many elements are evaluated at a time when forcing a
+ *   lazy expression. Has default value.
+ * - QUICKEN_THRESHOLD - How many times in a row a native must see the same
+ *   operand types before it is quickened. Has default value.
+ * - BUDGET_CLOCK_INTERVAL - How many elements natives go through between checks
+ *   of the wall-clock deadline. Has default value.
+ * - TLPIN_LIBRARY - Leaves out main, for building libtlpin. See tlpin.h.
+ * - TLPIN_NO_SIMD - Makes the lexer classify characters with plain C, even on
+ *   platforms with SSE2.
+ */
+
+// For pipe2.
+#define _GNU_SOURCE
+
 #include <stdint.h>
+#include <stdarg.h>
+#include <stddef.h>
 #include <assert.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <time.h>
+#include <ctype.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 
 #include "array.h"
+#include "tlpin.h"
+
+#if defined(__x86_64__) && defined(__unix__) && !defined(TLPIN_NO_JIT)
+#define TLPIN_JIT
+#endif // defined(__x86_64__) && defined(__unix__) && !defined(TLPIN_NO_JIT)
+
+#if defined(__SSE2__) && !defined(TLPIN_NO_SIMD)
+#define TLPIN_SSE2
+#include <emmintrin.h>
+#endif // defined(__SSE2__) && !defined(TLPIN_NO_SIMD)
+
+#ifndef JIT_HOT_THRESHOLD
+#define JIT_HOT_THRESHOLD 64
+#endif // JIT_HOT_THRESHOLD
+
+#ifndef INLINE_BUDGET
+#define INLINE_BUDGET 8
+#endif // INLINE_BUDGET
+
+#ifndef PARALLEL_THRESHOLD
+#define PARALLEL_THRESHOLD 4096
+#endif // PARALLEL_THRESHOLD
+
+#ifndef PARALLEL_CHUNK_SIZE
+#define PARALLEL_CHUNK_SIZE 256
+#endif // PARALLEL_CHUNK_SIZE
+
+#ifndef ELEMENTWISE_CHUNK_SIZE
+#define ELEMENTWISE_CHUNK_SIZE 2048
+#endif // ELEMENTWISE_CHUNK_SIZE
+
+#ifndef REDUCE_BLOCK_SIZE
+#define REDUCE_BLOCK_SIZE 1024
+#endif // REDUCE_BLOCK_SIZE
+
+#ifndef SORT_PARALLEL_THRESHOLD
+#define SORT_PARALLEL_THRESHOLD 65536
+#endif // SORT_PARALLEL_THRESHOLD
+
+#ifndef ARENA_BLOCK_SIZE
+#define ARENA_BLOCK_SIZE 65536
+#endif // ARENA_BLOCK_SIZE
+
+#ifndef MEMO_CAPACITY
+#define MEMO_CAPACITY 1024
+#endif // MEMO_CAPACITY
+
+#ifndef LAZY_BLOCK_SIZE
+#define LAZY_BLOCK_SIZE 256
+#endif // LAZY_BLOCK_SIZE
+
+#ifndef QUICKEN_THRESHOLD
+#define QUICKEN_THRESHOLD 8
+#endif // QUICKEN_THRESHOLD
+
+#ifndef BUDGET_CLOCK_INTERVAL
+#define BUDGET_CLOCK_INTERVAL 4096
+#endif // BUDGET_CLOCK_INTERVAL
 
 typedef double float64_t;
 
 
 
-/* typedef enum { */
-/*     TOKEN_STRING, */
-/*     TOKEN_CHARACTER, */
-/*     TOKEN_FLOAT, */
-/*     TOKEN_ATOM, */
-/*     TOKEN_NEWLINE, */
-/*     TOKEN_PARENTHESIS, */
-/*     TOKEN_BRACKET */
-/* } TokenType; */
-
-/* const char* token_type_name(TokenType type) { */
-/*     switch (type) { */
-/*     case TOKEN_STRING:      return "TOKEN_STRING"; */
-/*     case TOKEN_CHARACTER:   return "TOKEN_CHARACTER"; */
-/*     case TOKEN_FLOAT:       return "TOKEN_FLOAT"; */
-/*     case TOKEN_ATOM:        return "TOKEN_ATOM"; */
-/*     case TOKEN_NEWLINE:     return "TOKEN_NEWLINE"; */
-/*     case TOKEN_PARENTHESIS: return "TOKEN_PARENTHESIS"; */
-/*     case TOKEN_BRACKET:     return "TOKEN_BRACKET"; */
-/*     default:                assert(false && "Unhandled token type"); */
-/*     } */
-/* } */
-
-/* #define MAX_TOKEN_SIZE 256 */
-
-/* typedef union { */
-/*     sstring_t as_string; */
-/*     char      as_character; */
-/*     double    as_float; */
-/*     sstring_t as_atom; */
-/*     char      as_newline; */
-/*     char      as_parenthesis; */
-/*     char      as_bracket; */
-/* } Token; */
-
-/* typedef struct { */
-/*     TokenType type; */
-/*     Token     token; */
-/*     size_t    line; */
-/*     size_t    column; */
-/* } Lexeme; */
-
-/* void lexeme_free(Lexeme* lexeme, array_free_t free) { */
-/*     switch (lexeme->type) { */
-/*     case TOKEN_STRING:      sstring_free(&lexeme->token.as_string, free); break; */
-/*     case TOKEN_CHARACTER:   break; */
-/*     case TOKEN_FLOAT:       break; */
-/*     case TOKEN_ATOM:        sstring_free(&lexeme->token.as_atom, free); break; */
-/*     case TOKEN_NEWLINE:     break; */
-/*     case TOKEN_PARENTHESIS: break; */
-/*     case TOKEN_BRACKET:     break; */
-/*     default:                break; */
-/*     } */
-/* } */
-
-/* typedef ARRAY_OF(Lexeme) LexemeArray; */
-
-/* void lexeme_array_free(LexemeArray* lexemes, array_free_t free) { */
-/*     for (size_t i = 0; i < lexemes->count; ++i) */
-/*         lexeme_free(&array_at(lexemes, i), free); */
-/*     array_free(lexemes, free); */
-/* } */
-
-/* typedef struct { */
-/*     const sstring_t* program; */
-/*     size_t           program_index; */
-/*     const char*      program_name; */
-/*     sstring_t        token_buffer; */
-/*     LexemeArray      lexemes; */
-/*     size_t           line; */
-/*     size_t           column; */
-/*     size_t           multibyte_line; */
-/*     size_t           multibyte_column; */
-/*     array_realloc_t  realloc; */
-/*     bool             failed; */
-/* } LexerContext; */
-
-/* void try_append_multibyte_lexeme(LexerContext* context) { */
-/*     if (0 == context->token_buffer.count) return; */
-
-/*     Lexeme lexeme = {0}; */
-/*     lexeme.line   = context->multibyte_line; */
-/*     lexeme.column = context->multibyte_column; */
-
-/*     SstringConvertResult result; */
-
-/*     // We try to parse it as a float. */
-/*     double as_float = sstring_to_double(&context->token_buffer, &result); */
-/*     switch (result) { */
-/*     case SSTRING_CONVERT_SUCCESS: { */
-/*         lexeme.type           = TOKEN_FLOAT; */
-/*         lexeme.token.as_float = as_float; */
-/*         goto lend; */
-/*     } break; */
-/*     case SSTRING_CONVERT_UNDERFLOW: { */
-/*         (void)fprintf( */
-/*              stderr, */
-/*              "%s(%zu:%zu): Error: Float conversion of '%" SSTRING_PRINT */
-/*              "' results in underflow", */
-/*              context->program_name, */
-/*              lexeme.line, lexeme.column, */
-/*              SSTRING_FORMAT(&context->token_buffer) */
-/*         ); */
-/*         context->failed = true; */
-/*     } break; */
-/*     case SSTRING_CONVERT_OVERFLOW: { */
-/*         (void)fprintf( */
-/*              stderr, */
-/*              "%s(%zu:%zu): Error: Float conversion of '%" SSTRING_PRINT */
-/*              "' results in overflow", */
-/*              context->program_name, */
-/*              lexeme.line, lexeme.column, */
-/*              SSTRING_FORMAT(&context->token_buffer) */
-/*         ); */
-/*         context->failed = true; */
-/*     } break; */
-/*     case SSTRING_CONVERT_PARSE_FAIL: break; */
-/*     default: assert(false && "Unhandled sstring conversion result"); */
-/*     } */
-
-/*     // If that fails, we assume it is an atom. */
-/*     // TODO make this an array.h function. */
-/*     lexeme.type = TOKEN_ATOM; */
-/*     sstring_resize(&lexeme.token.as_atom, context->token_buffer.count, context->realloc); */
-/*     (void)memcpy( */
-/*          lexeme.token.as_atom.elements, */
-/*          context->token_buffer.elements, */
-/*          context->token_buffer.count */
-/*     ); */
-/*     lexeme.token.as_atom.count = context->token_buffer.count; */
-/*     context->token_buffer.count = 0; */
-/*     goto lend; */
-
-/*  lend: */
-/*     array_append(&context->lexemes, lexeme, context->realloc); */
-/*     context->token_buffer.count = 0; */
-/*     context->multibyte_line     = SIZE_MAX; */
-/*     context->multibyte_column   = SIZE_MAX; */
-/* } */
-
-/* void lex_string(LexerContext* context) { */
-/*     context->multibyte_line   = context->line; */
-/*     context->multibyte_column = context->column; */
-
-/*     // Skips past first quote. */
-/*     ++context->column; */
-/*     ++context->program_index; */
-
-/*     sstring_t string          = {0}; */
-/*     bool      found_end_quote = false; */
-
-/*     for (; context->program_index < context->program->count; ++context->program_index) { */
-/*         if (found_end_quote) break; */
-
-/*         char character = sstring_at(context->program, context->program_index); */
-
-/*         switch (character) { */
-/*         case '"': { */
-/*             found_end_quote = true; */
-/*             ++context->column; */
-/*         } break; */
-
-/*         case '\n': { */
-/*             ++context->line; */
-/*             context->column = 0; */
-/*         } break; */
-
-/*         case '\\': { */
-/*             if (++context->program_index >= context->program->count) { */
-/*                 goto lunterminated_string; */
-/*             } */
-/*             character = sstring_at(context->program, context->program_index); */
-
-/*             switch (character) { */
-/*             case '"':  sstring_append(&string, character, context->realloc); break; */
-/*             case '\\': sstring_append(&string, character, context->realloc); break; */
-/*             case 'n':  sstring_append(&string, '\n',      context->realloc); break; */
-/*             case 't':  sstring_append(&string, '\t',      context->realloc); break; */
-
-/*             default: { */
-/*                 (void)fprintf( */
-/*                      stderr, */
-/*                      "%s(%zu:%zu): Error: Unknown escape sequence '\\%c'", */
-/*                      context->program_name, */
-/*                      context->line, context->column, */
-/*                      character */
-/*                 ); */
-/*                 context->failed = true; */
-/*             } break; */
-/*             }; */
-
-/*             context->column += 2; */
-/*         } break; */
-
-/*         default: { */
-/*             sstring_append(&string, character, context->realloc); */
-/*             ++context->column; */
-/*         } break; */
-/*         }; */
-/*     } */
-
-/*     if (!found_end_quote) goto lunterminated_string; */
-
-/*     Lexeme lexeme = { */
-/*         .type   = TOKEN_STRING, */
-/*         .token  = { .as_string = string }, */
-/*         .line   = context->multibyte_line, */
-/*         .column = context->multibyte_column */
-/*     }; */
-/*     array_append(&context->lexemes, lexeme, context->realloc); */
-
-/*     context->multibyte_line   = SIZE_MAX; */
-/*     context->multibyte_column = SIZE_MAX; */
-
-/*     return; */
-
-/*  lunterminated_string: */
-/*     (void)fprintf( */
-/*          stderr, */
-/*          "%s(%zu:%zu): Error: Unterminated string", */
-/*          context->program_name, */
-/*          context->multibyte_line, context->multibyte_column */
-/*     ); */
-/*     exit(1); */
-/* } */
-
-/* void lex_character_literal(LexerContext* context) { */
-/*     context->multibyte_line   = context->line; */
-/*     context->multibyte_column = context->column; */
-
-/*     // Skips past first quote. */
-/*     ++context->column; ++context->program_index; */
-/*     if (context->program_index >= context->program->count) { */
-/*         goto lunterminated_character_literal; */
-/*     } */
-
-/*     char character = sstring_at(context->program, context->program_index); */
-
-/*     switch (character) { */
-/*     case '\\': { */
-/*         ++context->column; ++context->program_index; */
-/*         if (context->program_index >= context->program->count) { */
-/*             goto lunterminated_character_literal; */
-/*         } */
-
-/*         character = sstring_at(context->program, context->program_index); */
-
-/*         switch (character) { */
-/*         case '\'':  character = '\''; break; */
-/*         case '\\': character = '\\';  break; */
-/*         case 'n':  character = '\n';  break; */
-/*         case 't':  character = '\t';  break; */
-
-/*         default: { */
-/*             (void)fprintf( */
-/*                  stderr, */
-/*                  "%s(%zu:%zu): Error: Unknown escape sequence '\\%c'", */
-/*                  context->program_name, */
-/*                  context->line, context->column, */
-/*                  character */
-/*             ); */
-/*             context->failed = true; */
-/*         } break; */
-/*         } */
-/*     } break; */
-
-/*     default: break; */
-/*     }; */
-
-/*     ++context->column; ++context->program_index; */
-/*     if (context->program_index >= context->program->count) { */
-/*         goto lunterminated_character_literal; */
-/*     } */
-/*     if ('\'' != sstring_at(context->program, context->program_index)) { */
-/*         goto lunterminated_character_literal; */
-/*     }; */
-
-/*     ++context->column; ++context->program_index; */
-
-/*     Lexeme lexeme = { */
-/*         .type   = TOKEN_CHARACTER, */
-/*         .token  = { .as_character = character }, */
-/*         .line   = context->multibyte_line, */
-/*         .column = context->multibyte_column */
-/*     }; */
-/*     array_append(&context->lexemes, lexeme, context->realloc); */
-
-/*     context->multibyte_line   = SIZE_MAX; */
-/*     context->multibyte_column = SIZE_MAX; */
-
-/*     return; */
-
-/*  lunterminated_character_literal: */
-/*     (void)fprintf( */
-/*          stderr, */
-/*          "%s(%zu:%zu): Error: Unterminated character literal", */
-/*          context->program_name, */
-/*          context->multibyte_line, context->multibyte_column */
-/*     ); */
-/*     exit(1); */
-/* } */
-
-/* LexemeArray lex_program( const sstring_t *restrict program */
-/*                        , const char *restrict program_name */
-/*                        , array_free_t free */
-/*                        , array_realloc_t realloc) { */
-/*     LexerContext context = { */
-/*         .program           = program, */
-/*         .program_index     = 0, */
-/*         .program_name      = program_name, */
-/*         .token_buffer      = {0}, */
-/*         .lexemes           = {0}, */
-/*         .line              = 1, */
-/*         .column            = 0, */
-/*         .multibyte_line    = SIZE_MAX, */
-/*         .multibyte_column  = SIZE_MAX, */
-/*         .realloc           = realloc, */
-/*         .failed            = false */
-/*     }; */
-/*     // Since we have a limit on how large tokens can be we can preallocate the */
-/*     // buffer used to construct them. */
-/*     sstring_resize(&context.token_buffer, MAX_TOKEN_SIZE, context.realloc); */
-
-/*     for (; context.program_index < context.program->count; ++context.program_index) { */
-/*         char character = sstring_at(context.program, context.program_index); */
-
-/*         switch (character) { */
-/*         case '\n': { */
-/*             try_append_multibyte_lexeme(&context); */
-
-/*             Lexeme lexeme = { */
-/*                 .type   = TOKEN_NEWLINE, */
-/*                 .token  = { .as_newline = character }, */
-/*                 .line   = context.line, */
-/*                 .column = context.column */
-/*             }; */
-/*             array_append(&context.lexemes, lexeme, context.realloc); */
-
-/*             ++context.line; */
-/*             context.column = 0; */
-/*         } break; */
-
-/*         case '(': */
-/*         case ')': { */
-/*             try_append_multibyte_lexeme(&context); */
-
-/*             Lexeme lexeme = { */
-/*                 .type   = TOKEN_PARENTHESIS, */
-/*                 .token  = { .as_parenthesis = character }, */
-/*                 .line   = context.line, */
-/*                 .column = context.column */
-/*             }; */
-/*             array_append(&context.lexemes, lexeme, context.realloc); */
-
-/*             ++context.column; */
-/*         } break; */
-
-/*         case '{': */
-/*         case '}': { */
-/*             try_append_multibyte_lexeme(&context); */
-
-/*             Lexeme lexeme = { */
-/*                 .type   = TOKEN_BRACKET, */
-/*                 .token  = { .as_bracket = character }, */
-/*                 .line   = context.line, */
-/*                 .column = context.column */
-/*             }; */
-/*             array_append(&context.lexemes, lexeme, context.realloc); */
-
-/*             ++context.column; */
-/*         } break; */
-
-/*         case '"': { */
-/*             try_append_multibyte_lexeme(&context); */
-/*             lex_string(&context); */
-/*         } break; */
-
-/*         case '\'': { */
-/*             try_append_multibyte_lexeme(&context); */
-/*             lex_character_literal(&context); */
-/*         } break; */
-
-/*         case ' ': */
-/*         case '\t': { */
-/*             try_append_multibyte_lexeme(&context); */
-/*             ++context.column; */
-/*         } break; */
-
-/*         default: { */
-/*             if (MAX_TOKEN_SIZE <= context.token_buffer.count) { */
-/*                 (void)fprintf( */
-/*                      stderr, */
-/*                      "%s(%zu:%zu): Error: Encountered token larger than the" */
-/*                      "maximum allowed size %zu: %" SSTRING_PRINT, */
-/*                      context.program_name, */
-/*                      context.line, context.column, */
-/*                      (size_t)MAX_TOKEN_SIZE, */
-/*                      SSTRING_FORMAT(&context.token_buffer) */
-/*                 ); */
-/*                 exit(1); */
-/*             } */
-
-/*             if (SIZE_MAX == context.multibyte_line) { */
-/*                 context.multibyte_line = context.line; */
-/*             } */
-/*             if (SIZE_MAX == context.multibyte_column) { */
-/*                 context.multibyte_column = context.column; */
-/*             } */
-/*             sstring_append(&context.token_buffer, character, context.realloc); */
-
-/*             ++context.column; */
-/*         } break; */
-/*         } */
-/*     } */
-
-/*     try_append_multibyte_lexeme(&context); */
-
-/*     if (context.failed) exit(1); */
-
-/*     sstring_free(&context.token_buffer, free); */
-/*     return context.lexemes; */
-/* } */
-
-/* void dump_lexemes( FILE *restrict stream */
-/*                  , const LexemeArray *restrict lexemes */
-/*                  , const char *restrict program_name) { */
-/*     for (size_t i = 0; i < lexemes->count; ++i) { */
-/*         const Lexeme* lexeme = &array_at(lexemes, i); */
-
-/*         switch (lexeme->type) { */
-/*         case TOKEN_STRING: { */
-/*             (void)fprintf( */
-/*                  stream, */
-/*                  "%s(%zu:%zu): %s: \"", */
-/*                  program_name, lexeme->line, lexeme->column, */
-/*                  token_type_name(lexeme->type) */
-/*             ); */
-
-/*             for (size_t k = 0; k < lexeme->token.as_string.count; ++k) { */
-/*                 char character = sstring_at(&lexeme->token.as_string, k); */
-/*                 switch (character) { */
-/*                 case '"': */
-/*                 case '\\': { */
-/*                     (void)fputc('\\', stream); */
-/*                     (void)fputc(character, stream); */
-/*                 } break; */
-
-/*                 case '\n': { */
-/*                     (void)fputs("\\n", stream); */
-/*                 } break; */
-
-/*                 case '\t': { */
-/*                     (void)fputs("\\t", stream); */
-/*                 } break; */
-
-/*                 default: { */
-/*                     (void)fputc(character, stream); */
-/*                 } break; */
-/*                 } */
-/*             } */
-
-/*             (void)fputs("\"\n", stream); */
-/*         } break; */
-
-/*         case TOKEN_CHARACTER: { */
-/*             (void)fprintf( */
-/*                  stream, */
-/*                  "%s(%zu:%zu): %s: '", */
-/*                  program_name, lexeme->line, lexeme->column, */
-/*                  token_type_name(lexeme->type) */
-/*             ); */
-
-/*             char character = lexeme->token.as_character; */
-
-/*             switch (character) { */
-/*             case '\'': */
-/*             case '\\': { */
-/*                 (void)fputc('\\', stream); */
-/*                 (void)fputc(character, stream); */
-/*             } break; */
-
-/*             case '\n': { */
-/*                 (void)fputs("\\n", stream); */
-/*             } break; */
-
-/*             case '\t': { */
-/*                 (void)fputs("\\t", stream); */
-/*             } break; */
-
-/*             default: { */
-/*                 (void)fputc(character, stream); */
-/*             } break; */
-/*             } */
-
-/*             (void)fputs("'\n", stream); */
-/*         } break; */
-
-/*         case TOKEN_FLOAT: { */
-/*             (void)fprintf( */
-/*                  stream, */
-/*                  "%s(%zu:%zu): %s: %f\n", */
-/*                  program_name, lexeme->line, lexeme->column, */
-/*                  token_type_name(lexeme->type), */
-/*                  lexeme->token.as_float */
-/*             ); */
-/*         } break; */
-
-/*         case TOKEN_ATOM: { */
-/*             (void)fprintf( */
-/*                  stream, */
-/*                  "%s(%zu:%zu): %s: %" SSTRING_PRINT "\n", */
-/*                  program_name, lexeme->line, lexeme->column, */
-/*                  token_type_name(lexeme->type), */
-/*                  SSTRING_FORMAT(&lexeme->token.as_atom) */
-/*             ); */
-/*         } break; */
-
-/*         case TOKEN_NEWLINE: { */
-/*             (void)fprintf( */
-/*                  stream, */
-/*                  "%s(%zu:%zu): %s\n", */
-/*                  program_name, lexeme->line, lexeme->column, */
-/*                  token_type_name(lexeme->type) */
-/*             ); */
-/*         } break; */
-
-/*         case TOKEN_PARENTHESIS: { */
-/*             (void)fprintf( */
-/*                  stream, */
-/*                  "%s(%zu:%zu): %s: %c\n", */
-/*                  program_name, lexeme->line, lexeme->column, */
-/*                  token_type_name(lexeme->type), */
-/*                  lexeme->token.as_parenthesis */
-/*             ); */
-/*         } break; */
-
-/*         case TOKEN_BRACKET: { */
-/*             (void)fprintf( */
-/*                  stream, */
-/*                  "%s(%zu:%zu): %s: %c\n", */
-/*                  program_name, lexeme->line, lexeme->column, */
-/*                  token_type_name(lexeme->type), */
-/*                  lexeme->token.as_bracket */
-/*             ); */
-/*         } break; */
-
-/*         default: assert(false && "Unhandled token type"); */
-/*         }; */
-/*     } */
-/* } */
+/*
+ * Interpreters.
+ *
+ * Everything that configures or is built up by a run lives in an interpreter,
+ * so that independent interpreters can run on different threads at once. The
+ * thread's current interpreter is in interpreter, which starts out as the
+ * default one used by the command line. Threads of the thread pool take on the
+ * interpreter of whoever gave them the work.
+ */
+
+// The longest time limit in seconds. The deadline is kept in nanoseconds, so it
+// must fit in an int64_t along with the clock it's added to.
+#define BUDGET_TIME_LIMIT_MAX ((double)INT64_MAX / 1e9 / 2)
+
+/**
+ * Limits on how much work a run can do, see budget_start.
+ */
+typedef struct {
+    // Limits, set from the command line.
+    bool            fuel_limited;
+    int64_t         fuel_limit;
+    bool            time_limited;
+    double          time_limit;
+    // State of the current run, set by budget_start.
+    _Atomic int64_t fuel;
+    // In nanoseconds of budget_clock.
+    int64_t         deadline;
+} Budget;
+
+typedef struct MemoEntry MemoEntry;
+
+typedef struct {
+    // MEMO_CAPACITY buckets, allocated on first use.
+    MemoEntry**     buckets;
+    // Most recently used entry.
+    MemoEntry*      lru_head;
+    // Least recently used entry, first to be evicted.
+    MemoEntry*      lru_tail;
+    size_t          count;
+    size_t          hits;
+    size_t          misses;
+    pthread_mutex_t lock;
+} MemoCache;
+
+typedef struct {
+    // Used for everything the interpreter allocates, through ARRAY_* or
+    // interpreter_allocate. Must be thread-safe, since the thread pool
+    // allocates with it too.
+    array_allocator_t allocator;
+    // Compiles hot defuns to native code.
+    bool              jit_enabled;
+    // Caches the results of pure defuns.
+    bool              memoize_enabled;
+    // Defers arithmetic on arrays until the result is needed.
+    bool              lazy_enabled;
+    bool              quicken_enabled;
+    // Runs independent regions of pure code in parallel.
+    bool              dataflow_enabled;
+    Budget            budget;
+    MemoCache         memo_cache;
+} Interpreter;
+
+static Interpreter default_interpreter = {
+    .allocator        = { .realloc = &realloc, .free = &free },
+    .jit_enabled      = true,
+    .memoize_enabled  = false,
+    .lazy_enabled     = false,
+    .quicken_enabled  = true,
+    .dataflow_enabled = true,
+    .budget           = {0},
+    .memo_cache       = {
+        .buckets  = NULL,
+        .lru_head = NULL,
+        .lru_tail = NULL,
+        .count    = 0,
+        .hits     = 0,
+        .misses   = 0,
+        .lock     = PTHREAD_MUTEX_INITIALIZER
+    }
+};
+
+static _Thread_local Interpreter* interpreter = &default_interpreter;
+
+/**
+ * Allocates memory with the current interpreter's allocator, exiting if there
+ * isn't enough. The description says what it's for in the error message.
+ */
+static void* interpreter_allocate(size_t size, const char* description) {
+    // Never asks for nothing, so NULL always means out of memory.
+    void* memory = interpreter->allocator.realloc(NULL, 0 != size ? size : 1);
+    if (NULL == memory) {
+        (void)fprintf(stderr, "Error: Unable to allocate %s; buy more RAM lol", description);
+        exit(1);
+    }
+    return memory;
+}
+
+static void interpreter_free(void* memory) {
+    if (NULL != memory) interpreter->allocator.free(memory);
+}
 
 
 
 typedef enum {
     VALUE_NUMBER,
     VALUE_CHARACTER,
-    VALUE_ARRAY
+    VALUE_ARRAY,
+    // Deferred arithmetic, only created when lazy evaluation is enabled. Lazy
+    // values only ever appear directly on the stack, never inside of arrays.
+    VALUE_LAZY
 } ValueType;
 
 typedef struct Value Value;
 
 typedef ARRAY_OF(Value) ValueArray;
 
+typedef struct LazyNode LazyNode;
+
 struct Value {
     ValueType type;
     union {
         float64_t  as_number;
         uint8_t    as_character;
         ValueArray as_array;
+        LazyNode*  as_lazy;
     };
 };
 
+static void lazy_node_retain(LazyNode* node);
+static void lazy_node_release(LazyNode* node);
+
+static _Thread_local bool parallel_worker;
+
+static void parallel_for( size_t count
+                        , size_t chunk_size
+                        , void(*body)(void*, size_t, size_t)
+                        , void* context);
+static size_t thread_pool_size(void);
+
+static bool budget_expired(void);
+
+// How many elements of an array are looked at to guess how big it is.
+#define VALUE_SIZE_SAMPLES 8
+
+/**
+ * Decides whether it's worth splitting the elements of the array across the
+ * thread pool when copying or freeing it, which only pays off for big arrays
+ * of arrays. Guesses the size from a few evenly spaced elements instead of
+ * walking the whole thing. Returns how many elements each task should take,
+ * or 0 if it should be done on this thread.
+ */
+static size_t value_array_parallel_chunk(const ValueArray* array) {
+    if (parallel_worker || array->count < 2) return 0;
+
+    size_t samples = array->count < VALUE_SIZE_SAMPLES ? array->count : VALUE_SIZE_SAMPLES;
+    size_t nested  = 0;
+    for (size_t i = 0; i < samples; ++i) {
+        const Value* element = &array->elements[i * array->count / samples];
+        if (VALUE_ARRAY == element->type) nested += element->as_array.count;
+    }
+    if (0 == nested) return 0;
+
+    size_t element_size = nested / samples + 1;
+    if (array->count * element_size < PARALLEL_THRESHOLD) return 0;
+
+    return element_size >= ELEMENTWISE_CHUNK_SIZE ? 1 : ELEMENTWISE_CHUNK_SIZE / element_size;
+}
+
+static void value_free(Value* value);
+static Value value_deep_copy(const Value* value);
+
+static void value_free_task_body(void* elements, size_t start, size_t end) {
+    for (size_t i = start; i < end; ++i) value_free(&((Value*)elements)[i]);
+}
+
+typedef struct {
+    const Value* from;
+    Value*       to;
+} ValueCopyTask;
+
+static void value_copy_task_body(void* context, size_t start, size_t end) {
+    const ValueCopyTask* task = context;
+    for (size_t i = start; i < end; ++i) task->to[i] = value_deep_copy(&task->from[i]);
+}
+
 /**
- * Frees the underlying memory of the value, if there is any.
+ * Frees the underlying memory of the value, if there is any. Big nested arrays
+ * are freed on multiple threads.
  */
-void value_free(Value* value) {
+static void value_free(Value* value) {
     switch (value->type) {
     case VALUE_ARRAY: {
         ValueArray* value_array = &value->as_array;
-        for (size_t i = 0; i < value_array->count; ++i) {
-            value_free(&value_array->elements[i]);
+
+        size_t chunk_size = value_array_parallel_chunk(value_array);
+        if (0 != chunk_size) {
+            parallel_for(value_array->count, chunk_size, &value_free_task_body, value_array->elements);
+        } else {
+            for (size_t i = 0; i < value_array->count; ++i) {
+                value_free(&value_array->elements[i]);
+            }
         }
 
-        ARRAY_FREE(value_array, &array_stdlib_allocator);
+        ARRAY_FREE(value_array, &interpreter->allocator);
     } break;
 
+    case VALUE_LAZY: lazy_node_release(value->as_lazy); break;
+
     case VALUE_NUMBER:
     case VALUE_CHARACTER: break;
 
@@ -604,9 +335,10 @@ void value_free(Value* value) {
 
 /**
  * Performs a deep copy of the given value, recursively copying any nested
- * arrays.
+ * arrays. Lazy values share their expression, since it's immutable. Big nested
+ * arrays are copied on multiple threads.
  */
-Value value_deep_copy(const Value* value) {
+static Value value_deep_copy(const Value* value) {
     switch (value->type) {
     case VALUE_ARRAY: {
         Value new_value = {
@@ -615,15 +347,29 @@ Value value_deep_copy(const Value* value) {
         };
         new_value.as_array.count    = value->as_array.count;
         new_value.as_array.capacity = value->as_array.count;
-        ARRAY_REALLOCATE(&new_value.as_array, &array_stdlib_allocator);
+        ARRAY_REALLOCATE(&new_value.as_array, &interpreter->allocator);
 
-        for (size_t i = 0; i < value->as_array.count; ++i) {
-            new_value.as_array.elements[i] = value_deep_copy(&value->as_array.elements[i]);
+        size_t chunk_size = value_array_parallel_chunk(&value->as_array);
+        if (0 != chunk_size) {
+            ValueCopyTask task = {
+                .from = value->as_array.elements,
+                .to   = new_value.as_array.elements
+            };
+            parallel_for(value->as_array.count, chunk_size, &value_copy_task_body, &task);
+        } else {
+            for (size_t i = 0; i < value->as_array.count; ++i) {
+                new_value.as_array.elements[i] = value_deep_copy(&value->as_array.elements[i]);
+            }
         }
 
         return new_value;
     } break;
 
+    case VALUE_LAZY: {
+        lazy_node_retain(value->as_lazy);
+        return *value;
+    } break;
+
     case VALUE_NUMBER:
     case VALUE_CHARACTER: return *value;
 
@@ -637,48 +383,113 @@ typedef enum {
     ERROR_OK,
     ERROR_DOMAIN,
     ERROR_SHAPE,
-    ERROR_STACK_UNDERFLOW
+    ERROR_STACK_UNDERFLOW,
+    ERROR_OUT_OF_FUEL,
+    ERROR_TIMED_OUT,
+    // Internal, returned by quickened natives when their operands aren't the
+    // types they were specialized for. The stack is left untouched.
+    ERROR_GUARD
 } Error;
 
+static Error parallel_for_budgeted( size_t count
+                                  , size_t chunk_size
+                                  , void(*body)(void*, size_t, size_t)
+                                  , void* context);
+static Error budget_tick(size_t work);
+
 typedef enum {
     FUNCTION_NATIVE,
     FUNCTION_DEFUN,
-    FUNCTION_LITERAL
+    FUNCTION_LITERAL,
+    FUNCTION_EACH,
+    FUNCTION_RANK,
+    // Independent parts of a sequence of functions, run at the same time. Made
+    // by parallelize_regions.
+    FUNCTION_FORK
 } FunctionType;
 
 typedef struct Function Function;
 
 typedef ARRAY_OF(Function) FunctionArray;
 
-struct Function {
-    FunctionType type;
-    union {
-        Error(*as_native)(ValueArray*);
-        FunctionArray as_defun;
-        Value         as_literal;
-    };
-};
-
 /**
- * Frees the underlying memory of the function, if there is any.
+ * Native code generated by the JIT for a defun. entry is NULL if the defun has
+ * not been compiled.
  */
-void function_free(Function* function) {
-    switch (function->type) {
-    case FUNCTION_DEFUN: {
-        for (size_t i = 0; i < function->as_defun.count; ++i) {
-            function_free(&function->as_defun.elements[i]);
-        }
-    } break;
+typedef struct {
+    Error(*entry)(ValueArray*);
+    void*  memory;
+    size_t size;
+} JitCode;
 
-    case FUNCTION_LITERAL: {
-        value_free(&function->as_literal);
-    } break;
+typedef enum {
+    JIT_COLD,
+    JIT_COMPILING,
+    JIT_COMPILED,
+    // The JIT was unable to compile the defun, so we don't keep trying.
+    JIT_FAILED
+} JitState;
 
-    case FUNCTION_NATIVE: break;
+typedef enum {
+    MEMO_UNKNOWN,
+    MEMO_ANALYZING,
+    MEMO_MEMOIZABLE,
+    // Impure, or we can't tell how much of the stack it uses.
+    MEMO_UNMEMOIZABLE
+} MemoState;
+
+// The JIT and memoization bookkeeping is atomic since defuns can be run from
+// multiple threads at once by the parallel operators.
+typedef struct {
+    FunctionArray     functions;
+    // How many times the defun has been called, used to find hot defuns for
+    // the JIT.
+    _Atomic size_t    call_count;
+    _Atomic JitState  jit_state;
+    JitCode           jit_code;
+    _Atomic MemoState memo_state;
+    // Stack effect of the defun, only valid if memo_state is MEMO_MEMOIZABLE.
+    size_t            memo_inputs;
+    size_t            memo_outputs;
+} Defun;
 
-    default: assert(0 && "Unreachable");
+/**
+ * An operator applies it's functions to parts of the value on top of the
+ * stack.
+ *
+ * FUNCTION_EACH - applies the functions to each element of an array.
+ * FUNCTION_FORK - the functions are defuns that don't touch eachother's
+ * values, see parallelize_regions.
+ * FUNCTION_RANK - applies the functions to every sub-array (or scalar) nested
+ * no more than rank levels deep.
+ */
+typedef struct {
+    FunctionArray functions;
+    // Only used by FUNCTION_RANK.
+    size_t        rank;
+} Operator;
+
+struct Function {
+    FunctionType type;
+    union {
+        struct {
+            Error(*as_native)(ValueArray*);
+            // Type feedback for quickening, see native_observe. Atomic since
+            // the parallel operators run the same functions on many threads.
+            _Atomic uint8_t quicken_entry;
+            _Atomic uint8_t quicken_kind;
+            _Atomic uint8_t quicken_streak;
+            // 1 plus the QuickenKind of the specialized variant being used in
+            // place of as_native, or 0 if there isn't one.
+            _Atomic uint8_t quicken_active;
+        };
+        Defun    as_defun;
+        Value    as_literal;
+        Operator as_operator;
     };
-}
+};
+
+static void jit_code_free(JitCode* code);
 
 
 
@@ -688,7 +499,7 @@ void function_free(Function* function) {
  * any nested arrays are located at the same index in both arrays and are also
  * of the same length, so on so forth, recursively, for all nested arrays.
  */
-bool compare_array_shapes(const ValueArray* array1, const ValueArray* array2) {
+static bool compare_array_shapes(const ValueArray* array1, const ValueArray* array2) {
     if (array1->count != array2->count) return false;
 
     for (size_t i = 0; i < array1->count; ++i) {
@@ -703,7 +514,7 @@ bool compare_array_shapes(const ValueArray* array1, const ValueArray* array2) {
             return false;
         }
 
-        if (!compare_array_shapes(array1, array2)) {
+        if (!compare_array_shapes(&array1_element->as_array, &array2_element->as_array)) {
             return false;
         }
     }
@@ -713,6 +524,119 @@ bool compare_array_shapes(const ValueArray* array1, const ValueArray* array2) {
 
 
 
+static Error stack_force_budgeted(ValueArray* stack, size_t count);
+static bool lazy_numeric_dyadic(ValueArray* stack, float64_t(*operation)(float64_t,float64_t));
+
+static Error native_numeric_dyadic_eager(ValueArray* stack, float64_t(*operation)(float64_t,float64_t));
+
+static float64_t native_pona_operation(float64_t a, float64_t b);
+static float64_t native_ike_operation(float64_t a, float64_t b);
+static float64_t native_mute_operation(float64_t a, float64_t b);
+static float64_t native_kipisi_operation(float64_t a, float64_t b);
+
+/**
+ * An operation over flat arrays of numbers, where either operand can instead
+ * be a single number. The result may be written over one of the operands.
+ */
+typedef struct {
+    float64_t  (*operation)(float64_t, float64_t);
+    const Value* a;
+    const Value* b;
+    // 0 if the operand is a single number.
+    size_t       a_stride;
+    size_t       b_stride;
+    Value*       result;
+} NumericDyadicTask;
+
+static void numeric_dyadic_task_body(void* context, size_t start, size_t end) {
+    const NumericDyadicTask* task = context;
+    const Value* a = task->a;
+    const Value* b = task->b;
+    size_t a_stride = task->a_stride;
+    size_t b_stride = task->b_stride;
+    Value* result   = task->result;
+
+    // The common operations are spelled out so the compiler can vectorize them.
+    if (task->operation == &native_pona_operation) {
+        for (size_t i = start; i < end; ++i) result[i].as_number = a[i * a_stride].as_number + b[i * b_stride].as_number;
+    } else if (task->operation == &native_ike_operation) {
+        for (size_t i = start; i < end; ++i) result[i].as_number = a[i * a_stride].as_number - b[i * b_stride].as_number;
+    } else if (task->operation == &native_mute_operation) {
+        for (size_t i = start; i < end; ++i) result[i].as_number = a[i * a_stride].as_number * b[i * b_stride].as_number;
+    } else if (task->operation == &native_kipisi_operation) {
+        for (size_t i = start; i < end; ++i) result[i].as_number = a[i * a_stride].as_number / b[i * b_stride].as_number;
+    } else {
+        for (size_t i = start; i < end; ++i) {
+            result[i].as_number = task->operation(a[i * a_stride].as_number, b[i * b_stride].as_number);
+        }
+    }
+}
+
+/**
+ * Runs the task over count elements, on the thread pool if there's enough of
+ * them. Can run out of time part way through.
+ */
+static Error numeric_dyadic_flat(NumericDyadicTask* task, size_t count) {
+    if (count >= PARALLEL_THRESHOLD) {
+        return parallel_for_budgeted(count, ELEMENTWISE_CHUNK_SIZE, &numeric_dyadic_task_body, task);
+    }
+    numeric_dyadic_task_body(task, 0, count);
+    return ERROR_OK;
+}
+
+/**
+ * Returns true if the value is an array made up only of numbers.
+ */
+static bool value_is_flat_numeric(const Value* value) {
+    if (VALUE_ARRAY != value->type) return false;
+    for (size_t i = 0; i < value->as_array.count; ++i) {
+        if (VALUE_NUMBER != value->as_array.elements[i].type) return false;
+    }
+    return true;
+}
+
+/**
+ * Performs the operation if at least one operand is a large flat array of
+ * numbers and the other is a number or flat array of the same size, splitting
+ * the work across the thread pool. Returns false if the operands aren't like
+ * that, else puts how it went in result.
+ */
+static bool native_numeric_dyadic_parallel( ValueArray *restrict stack
+                                          , float64_t(*operation)(float64_t,float64_t)
+                                          , Error *restrict result) {
+    Value* a = &stack->elements[stack->count - 2];
+    Value* b = &stack->elements[stack->count - 1];
+
+    size_t a_count = VALUE_ARRAY == a->type ? a->as_array.count : 0;
+    size_t b_count = VALUE_ARRAY == b->type ? b->as_array.count : 0;
+    size_t count   = a_count > b_count ? a_count : b_count;
+    if (count < PARALLEL_THRESHOLD) return false;
+
+    if (VALUE_ARRAY == a->type && VALUE_ARRAY == b->type && a_count != b_count) return false;
+    if (VALUE_NUMBER != a->type && !value_is_flat_numeric(a)) return false;
+    if (VALUE_NUMBER != b->type && !value_is_flat_numeric(b)) return false;
+
+    NumericDyadicTask task = {
+        .operation = operation,
+        .a         = VALUE_ARRAY == a->type ? a->as_array.elements : a,
+        .b         = VALUE_ARRAY == b->type ? b->as_array.elements : b,
+        .a_stride  = VALUE_ARRAY == a->type ? 1 : 0,
+        .b_stride  = VALUE_ARRAY == b->type ? 1 : 0,
+        .result    = VALUE_ARRAY == a->type ? a->as_array.elements : b->as_array.elements
+    };
+    *result = numeric_dyadic_flat(&task, count);
+    if (ERROR_OK != *result) return true;
+
+    if (VALUE_ARRAY != a->type) {
+        *a = *b;
+    } else if (VALUE_ARRAY == b->type) {
+        value_free(b);
+    }
+    --stack->count;
+
+    return true;
+}
+
 /**
  * Performs a dyadic native function that works with numbers.
  *
@@ -724,35 +648,65 @@ bool compare_array_shapes(const ValueArray* array1, const ValueArray* array2) {
  * argument 2 as the elements of array.
  * On array,array - if arrays of same shape, recursively perform operation with
  * the elements of array 1 as argument 1 and the elements of array 2 as argument
- * 2, else shape error.
+ * 2, else shape error. Nested arrays are freed exactly once along the way, e.g.
+ * { { 1 2 } { 3 4 } } { { 1 1 } { 1 1 } } pona leaves { { 2 3 } { 4 5 } }.
+ *
+ * When lazy evaluation is enabled, operations on flat numeric arrays are
+ * deferred instead. Large flat numeric arrays are processed on multiple
+ * threads.
  */
-Error native_numeric_dyadic(ValueArray* stack, float64_t(*operation)(float64_t,float64_t)) {
+static Error native_numeric_dyadic(ValueArray* stack, float64_t(*operation)(float64_t,float64_t)) {
+    if (interpreter->lazy_enabled && lazy_numeric_dyadic(stack, operation)) return ERROR_OK;
+
+    Error result = stack_force_budgeted(stack, 2);
+    if (ERROR_OK != result) return result;
+    return native_numeric_dyadic_eager(stack, operation);
+}
+
+static Error native_numeric_dyadic_eager(ValueArray* stack, float64_t(*operation)(float64_t,float64_t)) {
     if (stack->count < 2) return ERROR_STACK_UNDERFLOW;
+    // Called for every element of nested arrays, so this is as good a place as
+    // any to keep an eye on the time.
+    if (ERROR_OK != budget_tick(1)) return ERROR_TIMED_OUT;
 
-    Value* a = &stack->elements[stack->count - 2];
-    Value* b = &stack->elements[stack->count - 1];
+    Error parallel_result;
+    if (native_numeric_dyadic_parallel(stack, operation, &parallel_result)) return parallel_result;
+
+    // The elements pushed while recursing alias the arrays, so they must be
+    // dropped if something goes wrong.
+    size_t stack_count = stack->count;
+
+    // Copied since the stack can be reallocated when recursing.
+    Value  a_value = stack->elements[stack->count - 2];
+    Value  b_value = stack->elements[stack->count - 1];
+    Value* a       = &a_value;
+    Value* b       = &b_value;
 
     switch (a->type) {
     case VALUE_NUMBER: {
         switch (b->type) {
         case VALUE_NUMBER: {
-            a->as_number = operation(a->as_number, b->as_number);
+            stack->elements[stack->count - 2].as_number = operation(a->as_number, b->as_number);
             --stack->count;
         } break;
         case VALUE_CHARACTER: return ERROR_DOMAIN;
         case VALUE_ARRAY: {
             for (size_t i = 0; i < b->as_array.count; ++i) {
                 Value* element = &b->as_array.elements[i];
-                ARRAY_APPEND(stack, &array_stdlib_allocator, *a);
-                ARRAY_APPEND(stack, &array_stdlib_allocator, *element);
-                Error result = native_numeric_dyadic(stack, operation);
-                if (ERROR_OK != result) return result;
+                ARRAY_APPEND(stack, &interpreter->allocator, *a);
+                ARRAY_APPEND(stack, &interpreter->allocator, *element);
+                Error result = native_numeric_dyadic_eager(stack, operation);
+                if (ERROR_OK != result) {
+                    stack->count = stack_count;
+                    return result;
+                }
                 *element = stack->elements[stack->count - 1];
                 --stack->count;
             }
-            *a = *b;
+            stack->elements[stack->count - 2] = *b;
             --stack->count;
         } break;
+        case VALUE_LAZY:
         default: assert(0 && "Unreachable");
         }
     } break;
@@ -764,10 +718,13 @@ Error native_numeric_dyadic(ValueArray* stack, float64_t(*operation)(float64_t,f
         case VALUE_NUMBER: {
             for (size_t i = 0; i < a->as_array.count; ++i) {
                 Value* element = &a->as_array.elements[i];
-                ARRAY_APPEND(stack, &array_stdlib_allocator, *element);
-                ARRAY_APPEND(stack, &array_stdlib_allocator, *b);
-                Error result = native_numeric_dyadic(stack, operation);
-                if (ERROR_OK != result) return result;
+                ARRAY_APPEND(stack, &interpreter->allocator, *element);
+                ARRAY_APPEND(stack, &interpreter->allocator, *b);
+                Error result = native_numeric_dyadic_eager(stack, operation);
+                if (ERROR_OK != result) {
+                    stack->count = stack_count;
+                    return result;
+                }
                 *element = stack->elements[stack->count - 1];
                 --stack->count;
             }
@@ -781,27 +738,34 @@ Error native_numeric_dyadic(ValueArray* stack, float64_t(*operation)(float64_t,f
             for (size_t i = 0; i < a->as_array.count; ++i) {
                 Value* a_element = &a->as_array.elements[i];
                 Value* b_element = &b->as_array.elements[i];
-                ARRAY_APPEND(stack, &array_stdlib_allocator, *a_element);
-                ARRAY_APPEND(stack, &array_stdlib_allocator, *b_element);
-                Error result = native_numeric_dyadic(stack, operation);
-                if (ERROR_OK != result) return result;
+                ARRAY_APPEND(stack, &interpreter->allocator, *a_element);
+                ARRAY_APPEND(stack, &interpreter->allocator, *b_element);
+                Error result = native_numeric_dyadic_eager(stack, operation);
+                if (ERROR_OK != result) {
+                    stack->count = stack_count;
+                    return result;
+                }
                 *a_element = stack->elements[stack->count - 1];
                 --stack->count;
+                // The recursive call already freed it.
+                *b_element = (Value){ .type = VALUE_NUMBER, .as_number = 0 };
             }
             value_free(b);
             --stack->count;
         } break;
+        case VALUE_LAZY:
         default: assert(0 && "Unreachable");
         }
     } break;
 
+    case VALUE_LAZY:
     default: assert(0 && "Unreachable");
     }
 
     return ERROR_OK;
 }
 
-float64_t native_pona_operation(float64_t a, float64_t b) { return a + b; }
+static float64_t native_pona_operation(float64_t a, float64_t b) { return a + b; }
 /**
  * Addition - dyadic.
  *
@@ -813,11 +777,11 @@ float64_t native_pona_operation(float64_t a, float64_t b) { return a + b; }
  * elements together, else
  * shape error.
  */
-Error native_pona(ValueArray* stack) {
+static Error native_pona(ValueArray* stack) {
     return native_numeric_dyadic(stack, &native_pona_operation);
 }
 
-float64_t native_ike_operation(float64_t a, float64_t b) { return a - b; }
+static float64_t native_ike_operation(float64_t a, float64_t b) { return a - b; }
 /**
  * Subtraction - dyadic.
  *
@@ -829,11 +793,11 @@ float64_t native_ike_operation(float64_t a, float64_t b) { return a - b; }
  * On array,array - if arrays of same shape, recursively subtracts individual
  * elements from eachother, else shape error.
  */
-Error native_ike(ValueArray* stack) {
+static Error native_ike(ValueArray* stack) {
     return native_numeric_dyadic(stack, &native_ike_operation);
 }
 
-float64_t native_mute_operation(float64_t a, float64_t b) { return a * b; }
+static float64_t native_mute_operation(float64_t a, float64_t b) { return a * b; }
 /**
  * Multiplication - dyadic.
  *
@@ -844,11 +808,11 @@ float64_t native_mute_operation(float64_t a, float64_t b) { return a * b; }
  * On array,array - if arrays of same shape, recursively multiplies individual
  * elements together, else shape error.
  */
-Error native_mute(ValueArray* stack) {
+static Error native_mute(ValueArray* stack) {
     return native_numeric_dyadic(stack, &native_mute_operation);
 }
 
-float64_t native_kipisi_operation(float64_t a, float64_t b) { return a / b; }
+static float64_t native_kipisi_operation(float64_t a, float64_t b) { return a / b; }
 /**
  * Divide - dyadic.
  *
@@ -860,7 +824,7 @@ float64_t native_kipisi_operation(float64_t a, float64_t b) { return a / b; }
  * On array,array - if arrays of same shape, recursively divides individual
  * elements by eachother, else shape error.
  */
-Error native_kipisi(ValueArray* stack) {
+static Error native_kipisi(ValueArray* stack) {
     return native_numeric_dyadic(stack, &native_kipisi_operation);
 }
 
@@ -871,8 +835,10 @@ Error native_kipisi(ValueArray* stack) {
  * On character - domain error.
  * On array - TODO.
  */
-Error native_nanpa(ValueArray* stack) {
+static Error native_nanpa(ValueArray* stack) {
     if (stack->count < 1) return ERROR_STACK_UNDERFLOW;
+    Error result = stack_force_budgeted(stack, 1);
+    if (ERROR_OK != result) return result;
 
     Value* a = &stack->elements[stack->count - 1];
 
@@ -888,9 +854,13 @@ Error native_nanpa(ValueArray* stack) {
         index.type = VALUE_NUMBER;
 
         for (float64_t i = 1; i <= max_index; ++i) {
+            if (ERROR_OK != budget_tick(1)) {
+                value_free(&index_array);
+                return ERROR_TIMED_OUT;
+            }
             index.as_number = i;
             // TODO: make preallocate memory.
-            ARRAY_APPEND(&index_array.as_array, &array_stdlib_allocator, index);
+            ARRAY_APPEND(&index_array.as_array, &interpreter->allocator, index);
         }
 
         stack->elements[stack->count - 1] = index_array;
@@ -900,6 +870,358 @@ Error native_nanpa(ValueArray* stack) {
 
     case VALUE_ARRAY: assert(0 && "TODO");
 
+    case VALUE_LAZY:
+    default: assert(0 && "Unreachable");
+    }
+
+    return ERROR_OK;
+}
+
+/**
+ * Sums the numbers pairwise, so the order of additions only depends on how
+ * many there are.
+ */
+static float64_t sum_pairwise(const float64_t* numbers, size_t count) {
+    if (0 == count) return 0;
+    if (1 == count) return numbers[0];
+
+    size_t half = count / 2;
+    return sum_pairwise(numbers, half) + sum_pairwise(&numbers[half], count - half);
+}
+
+/**
+ * Sums of the REDUCE_BLOCK_SIZE sized blocks of an array.
+ */
+typedef struct {
+    const Value* elements;
+    size_t       count;
+    float64_t*   sums;
+} SumTask;
+
+static void sum_task_body(void* context, size_t start, size_t end) {
+    const SumTask* task = context;
+
+    for (size_t block = start; block < end; ++block) {
+        size_t first = block * REDUCE_BLOCK_SIZE;
+        size_t last  = first + REDUCE_BLOCK_SIZE < task->count ? first + REDUCE_BLOCK_SIZE : task->count;
+
+        float64_t sum = 0;
+        for (size_t i = first; i < last; ++i) sum += task->elements[i].as_number;
+        task->sums[block] = sum;
+    }
+}
+
+/**
+ * Sum - monadic.
+ *
+ * On number - the number.
+ * On character - domain error.
+ * On array of numbers - adds up the numbers.
+ * On array - domain error if it contains anything but numbers.
+ *
+ * The array is split into fixed size blocks that are summed on the thread pool
+ * and then combined pairwise, so the result is the same no matter how many
+ * threads there are.
+ */
+static Error native_ale(ValueArray* stack) {
+    if (stack->count < 1) return ERROR_STACK_UNDERFLOW;
+    Error result = stack_force_budgeted(stack, 1);
+    if (ERROR_OK != result) return result;
+
+    Value* a = &stack->elements[stack->count - 1];
+
+    switch (a->type) {
+    case VALUE_NUMBER: break;
+
+    case VALUE_CHARACTER: return ERROR_DOMAIN;
+
+    case VALUE_ARRAY: {
+        if (!value_is_flat_numeric(a)) return ERROR_DOMAIN;
+
+        size_t count  = a->as_array.count;
+        size_t blocks = (count + REDUCE_BLOCK_SIZE - 1) / REDUCE_BLOCK_SIZE;
+
+        float64_t* sums = interpreter_allocate(blocks * sizeof(float64_t), "partial sums");
+
+        SumTask task = {
+            .elements = a->as_array.elements,
+            .count    = count,
+            .sums     = sums
+        };
+        Error result = ERROR_OK;
+        if (count >= PARALLEL_THRESHOLD) {
+            result = parallel_for_budgeted(blocks, 1, &sum_task_body, &task);
+        } else {
+            sum_task_body(&task, 0, blocks);
+        }
+
+        float64_t sum = sum_pairwise(sums, blocks);
+        interpreter_free(sums);
+        if (ERROR_OK != result) return result;
+
+        value_free(a);
+        a->type      = VALUE_NUMBER;
+        a->as_number = sum;
+    } break;
+
+    case VALUE_LAZY:
+    default: assert(0 && "Unreachable");
+    }
+
+    return ERROR_OK;
+}
+
+/**
+ * Turns the number into an integer that sorts the same way, with negative
+ * numbers below positive ones.
+ */
+static uint64_t sort_key_from_number(float64_t number) {
+    uint64_t bits;
+    (void)memcpy(&bits, &number, sizeof(bits));
+    return bits >> 63 ? ~bits : bits | (1ULL << 63);
+}
+
+static float64_t sort_key_to_number(uint64_t key) {
+    uint64_t bits = key >> 63 ? key & ~(1ULL << 63) : ~key;
+    float64_t number;
+    (void)memcpy(&number, &bits, sizeof(number));
+    return number;
+}
+
+/**
+ * Sorts the keys with a least significant digit first radix sort, a byte at a
+ * time, using scratch as temporary space of the same size.
+ */
+static void radix_sort(uint64_t *restrict keys, uint64_t *restrict scratch, size_t count) {
+    if (count < 64) {
+        for (size_t i = 1; i < count; ++i) {
+            uint64_t key = keys[i];
+            size_t   k   = i;
+            for (; k > 0 && keys[k - 1] > key; --k) keys[k] = keys[k - 1];
+            keys[k] = key;
+        }
+        return;
+    }
+
+    uint64_t* from = keys;
+    uint64_t* to   = scratch;
+    for (unsigned shift = 0; shift < 64; shift += 8) {
+        size_t counts[256] = {0};
+        for (size_t i = 0; i < count; ++i) ++counts[(from[i] >> shift) & 0xFF];
+        // Every key has the same digit, so this pass wouldn't move anything.
+        if (count == counts[(from[0] >> shift) & 0xFF]) continue;
+
+        size_t offset = 0;
+        for (size_t digit = 0; digit < 256; ++digit) {
+            size_t digit_count = counts[digit];
+            counts[digit] = offset;
+            offset += digit_count;
+        }
+        for (size_t i = 0; i < count; ++i) to[counts[(from[i] >> shift) & 0xFF]++] = from[i];
+
+        uint64_t* swap = from;
+        from = to;
+        to   = swap;
+    }
+
+    if (from != keys) (void)memcpy(keys, from, count * sizeof(uint64_t));
+}
+
+/**
+ * State of a parallel sample sort. The keys are split into chunks, each chunk
+ * counts how many of it's keys fall into each bucket between the splitters,
+ * then the keys are scattered into their buckets, which are sorted on their
+ * own.
+ */
+typedef struct {
+    uint64_t*       keys;
+    uint64_t*       scratch;
+    size_t          count;
+    size_t          chunk_size;
+    const uint64_t* splitters;
+    size_t          bucket_count;
+    // Where each chunk puts it's keys of each bucket, chunk major.
+    size_t*         offsets;
+    // bucket_count + 1 entries.
+    size_t*         bucket_starts;
+} SampleSort;
+
+static size_t sample_sort_bucket(const SampleSort* sort, uint64_t key) {
+    // Finds the first splitter above the key.
+    size_t low  = 0;
+    size_t high = sort->bucket_count - 1;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (sort->splitters[middle] <= key) low  = middle + 1;
+        else                                high = middle;
+    }
+    return low;
+}
+
+static void sample_sort_count_body(void* context, size_t start, size_t end) {
+    SampleSort* sort = context;
+
+    for (size_t chunk = start; chunk < end; ++chunk) {
+        size_t* counts = &sort->offsets[chunk * sort->bucket_count];
+        size_t  first  = chunk * sort->chunk_size;
+        size_t  last   = first + sort->chunk_size < sort->count ? first + sort->chunk_size : sort->count;
+        for (size_t i = first; i < last; ++i) ++counts[sample_sort_bucket(sort, sort->keys[i])];
+    }
+}
+
+static void sample_sort_scatter_body(void* context, size_t start, size_t end) {
+    SampleSort* sort = context;
+
+    for (size_t chunk = start; chunk < end; ++chunk) {
+        size_t* offsets = &sort->offsets[chunk * sort->bucket_count];
+        size_t  first   = chunk * sort->chunk_size;
+        size_t  last    = first + sort->chunk_size < sort->count ? first + sort->chunk_size : sort->count;
+        for (size_t i = first; i < last; ++i) {
+            uint64_t key = sort->keys[i];
+            sort->scratch[offsets[sample_sort_bucket(sort, key)]++] = key;
+        }
+    }
+}
+
+static void sample_sort_bucket_body(void* context, size_t start, size_t end) {
+    SampleSort* sort = context;
+
+    for (size_t bucket = start; bucket < end; ++bucket) {
+        size_t first = sort->bucket_starts[bucket];
+        size_t last  = sort->bucket_starts[bucket + 1];
+        // The keys are in scratch now, so keys is free to be the scratch space.
+        radix_sort(&sort->scratch[first], &sort->keys[first], last - first);
+    }
+}
+
+/**
+ * Sorts the keys on the thread pool, using scratch as temporary space of the
+ * same size. If it runs out of time, the keys are left in any order.
+ */
+static Error sample_sort(uint64_t *restrict keys, uint64_t *restrict scratch, size_t count) {
+    // Oversamples evenly spaced keys so the buckets come out about even.
+    size_t oversampling = 32;
+
+    size_t threads      = thread_pool_size();
+    size_t bucket_count = threads * 4;
+    while (bucket_count > 1 && bucket_count * oversampling > count) bucket_count /= 2;
+    size_t chunk_count  = threads * 4;
+    size_t chunk_size   = (count + chunk_count - 1) / chunk_count;
+    chunk_count = (count + chunk_size - 1) / chunk_size;
+
+    size_t    sample_count = bucket_count * oversampling;
+    uint64_t* samples      = interpreter_allocate(2 * sample_count * sizeof(uint64_t), "sort buckets");
+    uint64_t* splitters    = interpreter_allocate(bucket_count * sizeof(uint64_t), "sort buckets");
+    size_t*   offsets      = interpreter_allocate(chunk_count * bucket_count * sizeof(size_t), "sort buckets");
+    size_t*   starts       = interpreter_allocate((bucket_count + 1) * sizeof(size_t), "sort buckets");
+    (void)memset(offsets, 0, chunk_count * bucket_count * sizeof(size_t));
+
+    for (size_t i = 0; i < sample_count; ++i) samples[i] = keys[i * (count / sample_count)];
+    radix_sort(samples, &samples[sample_count], sample_count);
+    for (size_t i = 0; i + 1 < bucket_count; ++i) splitters[i] = samples[(i + 1) * oversampling];
+
+    SampleSort sort = {
+        .keys          = keys,
+        .scratch       = scratch,
+        .count         = count,
+        .chunk_size    = chunk_size,
+        .splitters     = splitters,
+        .bucket_count  = bucket_count,
+        .offsets       = offsets,
+        .bucket_starts = starts
+    };
+    Error result = parallel_for_budgeted(chunk_count, 1, &sample_sort_count_body, &sort);
+    if (ERROR_OK != result) goto lfree;
+
+    size_t offset = 0;
+    for (size_t bucket = 0; bucket < bucket_count; ++bucket) {
+        starts[bucket] = offset;
+        for (size_t chunk = 0; chunk < chunk_count; ++chunk) {
+            size_t chunk_bucket_count = offsets[chunk * bucket_count + bucket];
+            offsets[chunk * bucket_count + bucket] = offset;
+            offset += chunk_bucket_count;
+        }
+    }
+    starts[bucket_count] = offset;
+
+    result = parallel_for_budgeted(chunk_count, 1, &sample_sort_scatter_body, &sort);
+    if (ERROR_OK != result) goto lfree;
+    result = parallel_for_budgeted(bucket_count, 1, &sample_sort_bucket_body, &sort);
+    if (ERROR_OK != result) goto lfree;
+    (void)memcpy(keys, scratch, count * sizeof(uint64_t));
+
+ lfree:
+    interpreter_free(samples);
+    interpreter_free(splitters);
+    interpreter_free(offsets);
+    interpreter_free(starts);
+    return result;
+}
+
+/**
+ * Sort - monadic.
+ *
+ * On number or character - the value.
+ * On array of numbers or array of characters - sorts the elements from lowest
+ * to highest.
+ * On array - domain error if it mixes types or contains arrays.
+ *
+ * Arrays with at least SORT_PARALLEL_THRESHOLD elements are sorted on the
+ * thread pool.
+ */
+static Error native_nasin(ValueArray* stack) {
+    if (stack->count < 1) return ERROR_STACK_UNDERFLOW;
+    Error result = stack_force_budgeted(stack, 1);
+    if (ERROR_OK != result) return result;
+
+    Value* a = &stack->elements[stack->count - 1];
+
+    switch (a->type) {
+    case VALUE_NUMBER:
+    case VALUE_CHARACTER: break;
+
+    case VALUE_ARRAY: {
+        size_t count = a->as_array.count;
+        if (0 == count) break;
+
+        Value*    elements = a->as_array.elements;
+        ValueType type     = elements[0].type;
+        if (VALUE_ARRAY == type) return ERROR_DOMAIN;
+        for (size_t i = 1; i < count; ++i) {
+            if (type != elements[i].type) return ERROR_DOMAIN;
+        }
+
+        uint64_t* keys    = interpreter_allocate(count * sizeof(uint64_t), "sort keys");
+        uint64_t* scratch = interpreter_allocate(count * sizeof(uint64_t), "sort keys");
+
+        for (size_t i = 0; i < count; ++i) {
+            keys[i] = VALUE_NUMBER == type
+                    ? sort_key_from_number(elements[i].as_number)
+                    : elements[i].as_character;
+        }
+
+        Error result = ERROR_OK;
+        if (count >= SORT_PARALLEL_THRESHOLD && thread_pool_size() > 1) {
+            result = sample_sort(keys, scratch, count);
+        } else {
+            radix_sort(keys, scratch, count);
+        }
+        if (ERROR_OK != result) {
+            interpreter_free(keys);
+            interpreter_free(scratch);
+            return result;
+        }
+
+        for (size_t i = 0; i < count; ++i) {
+            if (VALUE_NUMBER == type) elements[i].as_number    = sort_key_to_number(keys[i]);
+            else                      elements[i].as_character = (uint8_t)keys[i];
+        }
+
+        interpreter_free(keys);
+        interpreter_free(scratch);
+    } break;
+
+    case VALUE_LAZY:
     default: assert(0 && "Unreachable");
     }
 
@@ -911,8 +1233,10 @@ Error native_nanpa(ValueArray* stack) {
  *
  * On *,* - joins the elements/values into a single array.
  */
-Error native_olin(ValueArray* stack) {
+static Error native_olin(ValueArray* stack) {
     if (stack->count < 2) return ERROR_STACK_UNDERFLOW;
+    Error result = stack_force_budgeted(stack, 2);
+    if (ERROR_OK != result) return result;
 
     Value* a = &stack->elements[stack->count - 2];
     Value* b = &stack->elements[stack->count - 1];
@@ -926,18 +1250,19 @@ Error native_olin(ValueArray* stack) {
                 .type     = VALUE_ARRAY,
                 .as_array = {0}
             };
-            ARRAY_APPEND(&result.as_array, &array_stdlib_allocator, *a);
-            ARRAY_APPEND(&result.as_array, &array_stdlib_allocator, *b);
+            ARRAY_APPEND(&result.as_array, &interpreter->allocator, *a);
+            ARRAY_APPEND(&result.as_array, &interpreter->allocator, *b);
             *a = result;
             --stack->count;
         } break;
 
         case VALUE_ARRAY: {
-            ARRAY_PREPEND(&b->as_array, &array_stdlib_allocator, *a);
+            ARRAY_PREPEND(&b->as_array, &interpreter->allocator, *a);
             *a = *b;
             --stack->count;
         } break;
 
+        case VALUE_LAZY:
         default: assert(0 && "Unreachable");
         }
     } break;
@@ -950,18 +1275,19 @@ Error native_olin(ValueArray* stack) {
                 .type     = VALUE_ARRAY,
                 .as_array = {0}
             };
-            ARRAY_APPEND(&result.as_array, &array_stdlib_allocator, *a);
-            ARRAY_APPEND(&result.as_array, &array_stdlib_allocator, *b);
+            ARRAY_APPEND(&result.as_array, &interpreter->allocator, *a);
+            ARRAY_APPEND(&result.as_array, &interpreter->allocator, *b);
             *a = result;
             --stack->count;
         } break;
 
         case VALUE_ARRAY: {
-            ARRAY_PREPEND(&b->as_array, &array_stdlib_allocator, *a);
+            ARRAY_PREPEND(&b->as_array, &interpreter->allocator, *a);
             *a = *b;
             --stack->count;
         } break;
 
+        case VALUE_LAZY:
         default: assert(0 && "Unreachable");
         }
     } break;
@@ -970,200 +1296,4444 @@ Error native_olin(ValueArray* stack) {
         switch (b->type) {
         case VALUE_NUMBER:
         case VALUE_CHARACTER: {
-            ARRAY_APPEND(&a->as_array, &array_stdlib_allocator, *b);
+            ARRAY_APPEND(&a->as_array, &interpreter->allocator, *b);
             --stack->count;
         } break;
 
         case VALUE_ARRAY: {
-            ARRAY_CONCATENATE(&b->as_array, &array_stdlib_allocator, &a->as_array);
-            ARRAY_FREE(&b->as_array, &array_stdlib_allocator);
+            ARRAY_CONCATENATE(&b->as_array, &interpreter->allocator, &a->as_array);
+            ARRAY_FREE(&b->as_array, &interpreter->allocator);
             --stack->count;
         } break;
 
+        case VALUE_LAZY:
         default: assert(0 && "Unreachable");
         }
     } break;
 
+    case VALUE_LAZY:
     default: assert(0 && "Unreachable");
     }
 
     return ERROR_OK;
 }
 
+extern char** environ;
+
 /**
- * Call command - monadic.
- *
- * On character array - call the system shell with the supplied text as the
- * command.
- * On *,* - domain error.
+ * Arguments to spawn a process with.
  */
-Error native_o(ValueArray* stack) {
-    if (stack->count < 1) return ERROR_STACK_UNDERFLOW;
+typedef struct {
+    // NULL terminated.
+    char** arguments;
+    // Backing memory for the strings in arguments.
+    char*  strings;
+} CommandLine;
 
-    Value* a = &stack->elements[stack->count - 1];
-    if (VALUE_ARRAY != a->type) return ERROR_DOMAIN;
+/**
+ * Copies the characters of the string value into buffer, followed by a null
+ * terminator. Returns false if it isn't a string.
+ */
+static bool string_copy(const Value *restrict string, char *restrict buffer) {
+    for (size_t i = 0; i < string->as_array.count; ++i) {
+        const Value* element = &string->as_array.elements[i];
+        if (VALUE_CHARACTER != element->type) return false;
+        buffer[i] = (char)element->as_character;
+    }
+    buffer[string->as_array.count] = '\0';
+    return true;
+}
+
+/**
+ * Builds a command line from a command value. Returns false if the command is
+ * malformed.
+ *
+ * On character array - runs the text with the system shell.
+ * On array of character arrays - runs the program named by the first string
+ * directly, without a shell, with the rest as it's arguments.
+ */
+static bool command_line_make(const Value *restrict command, CommandLine *restrict command_line) {
+    command_line->arguments = NULL;
+    command_line->strings   = NULL;
+
+    if (VALUE_ARRAY != command->type || 0 == command->as_array.count) return false;
+    const ValueArray* array = &command->as_array;
+
+    if (VALUE_ARRAY != array->elements[0].type) {
+        command_line->strings   = interpreter_allocate(array->count + 1, "command line");
+        command_line->arguments = interpreter_allocate(4 * sizeof(char*), "command line");
+        if (!string_copy(command, command_line->strings)) goto lmalformed;
+
+        command_line->arguments[0] = "/bin/sh";
+        command_line->arguments[1] = "-c";
+        command_line->arguments[2] = command_line->strings;
+        command_line->arguments[3] = NULL;
+        return true;
+    }
+
+    size_t size = 0;
+    for (size_t i = 0; i < array->count; ++i) {
+        if (VALUE_ARRAY != array->elements[i].type) goto lmalformed;
+        size += array->elements[i].as_array.count + 1;
+    }
+
+    command_line->strings   = interpreter_allocate(size, "command line");
+    command_line->arguments = interpreter_allocate((array->count + 1) * sizeof(char*), "command line");
+
+    char* string = command_line->strings;
+    for (size_t i = 0; i < array->count; ++i) {
+        if (!string_copy(&array->elements[i], string)) goto lmalformed;
+        command_line->arguments[i] = string;
+        string += array->elements[i].as_array.count + 1;
+    }
+    command_line->arguments[array->count] = NULL;
+    return true;
+
+ lmalformed:
+    interpreter_free(command_line->arguments);
+    interpreter_free(command_line->strings);
+    return false;
+}
+
+static void command_line_free(CommandLine* command_line) {
+    interpreter_free(command_line->arguments);
+    interpreter_free(command_line->strings);
+}
+
+/**
+ * Starts the command. If output_fd isn't -1, the child's stdout is redirected
+ * to it. Returns false if the process could not be started.
+ */
+static bool command_spawn(const CommandLine *restrict command_line, int output_fd, pid_t *restrict pid) {
+    // So earlier output doesn't end up after the child's.
+    (void)fflush(stdout);
+
+    posix_spawn_file_actions_t file_actions;
+    if (0 != posix_spawn_file_actions_init(&file_actions)) return false;
+    if (-1 != output_fd) {
+        (void)posix_spawn_file_actions_adddup2(&file_actions, output_fd, STDOUT_FILENO);
+    }
+
+    int error = posix_spawnp(
+        pid,
+        command_line->arguments[0],
+        &file_actions,
+        NULL,
+        command_line->arguments,
+        environ
+    );
+
+    (void)posix_spawn_file_actions_destroy(&file_actions);
+    return 0 == error;
+}
+
+/**
+ * Waits for the process to finish and returns it's exit status. Processes
+ * killed by a signal get 128 plus the signal number, like in the shell.
+ */
+static int command_wait(pid_t pid) {
+    int status;
+    while (-1 == waitpid(pid, &status, 0)) {
+        if (EINTR != errno) return 127;
+    }
+
+    if (WIFEXITED(status))   return WEXITSTATUS(status);
+    if (WIFSIGNALED(status)) return 128 + WTERMSIG(status);
+    return 127;
+}
+
+/**
+ * Creates a pipe whose ends don't leak into other child processes. The ends are
+ * close-on-exec from the start, as another thread could spawn a command in
+ * between creating the pipe and setting the flag.
+ */
+static bool pipe_make(int fds[2]) {
+    return 0 == pipe2(fds, O_CLOEXEC);
+}
+
+/**
+ * Call command - monadic.
+ *
+ * On character array - call the system shell with the supplied text as the
+ * command.
+ * On array of character arrays - run the program named by the first string
+ * with the rest as it's arguments, without a shell.
+ * On *,* - domain error.
+ */
+static Error native_o(ValueArray* stack) {
+    if (stack->count < 1) return ERROR_STACK_UNDERFLOW;
+    Error result = stack_force_budgeted(stack, 1);
+    if (ERROR_OK != result) return result;
+
+    Value* a = &stack->elements[stack->count - 1];
+
+    CommandLine command_line;
+    if (!command_line_make(a, &command_line)) return ERROR_DOMAIN;
+
+    pid_t pid;
+    if (command_spawn(&command_line, -1, &pid)) (void)command_wait(pid);
+    command_line_free(&command_line);
+
+    value_free(a);
+    --stack->count;
+    return ERROR_OK;
+}
+
+/**
+ * Reads everything available from the file descriptor, appending it to the
+ * array as characters. Returns true if the file descriptor is non-blocking and
+ * more may come later, false on end of file.
+ */
+static bool read_characters(int fd, ValueArray* characters) {
+    uint8_t buffer[4096];
+
+    for (;;) {
+        ssize_t count = read(fd, buffer, sizeof(buffer));
+        if (count < 0 && EINTR == errno) continue;
+        if (count < 0 && (EAGAIN == errno || EWOULDBLOCK == errno)) return true;
+        if (count <= 0) return false;
+
+        if (characters->count + (size_t)count > characters->capacity) {
+            size_t capacity = 0 == characters->capacity ? sizeof(buffer) : characters->capacity;
+            while (characters->count + (size_t)count > capacity) capacity *= ARRAY_CAPACITY_MULTIPLIER;
+            ARRAY_RESIZE(characters, &interpreter->allocator, capacity);
+        }
+
+        for (ssize_t i = 0; i < count; ++i) {
+            Value* character = &characters->elements[characters->count++];
+            character->type         = VALUE_CHARACTER;
+            character->as_character = buffer[i];
+        }
+    }
+}
+
+/**
+ * Call command and capture output - monadic.
+ *
+ * Takes the same commands as o, but the output of the command is captured
+ * instead of being printed. Leaves the output as a character array followed by
+ * the exit status. If the command couldn't be started, the output is empty and
+ * the status is 127.
+ * On *,* - domain error.
+ */
+static Error native_kute(ValueArray* stack) {
+    if (stack->count < 1) return ERROR_STACK_UNDERFLOW;
+    Error result = stack_force_budgeted(stack, 1);
+    if (ERROR_OK != result) return result;
+
+    Value* a = &stack->elements[stack->count - 1];
+
+    CommandLine command_line;
+    if (!command_line_make(a, &command_line)) return ERROR_DOMAIN;
+
+    Value output = {
+        .type     = VALUE_ARRAY,
+        .as_array = {0}
+    };
+    int status = 127;
+
+    int   fds[2];
+    pid_t pid;
+    if (pipe_make(fds)) {
+        bool spawned = command_spawn(&command_line, fds[1], &pid);
+        (void)close(fds[1]);
+        if (spawned) {
+            (void)read_characters(fds[0], &output.as_array);
+            status = command_wait(pid);
+        }
+        (void)close(fds[0]);
+    }
+    command_line_free(&command_line);
+
+    value_free(a);
+    stack->elements[stack->count - 1] = output;
+
+    Value exit_status = {
+        .type      = VALUE_NUMBER,
+        .as_number = status
+    };
+    ARRAY_APPEND(stack, &interpreter->allocator, exit_status);
+
+    return ERROR_OK;
+}
+
+/**
+ * A command started by native_kulupu that has yet to finish.
+ */
+typedef struct {
+    pid_t  pid;
+    size_t index;
+} Job;
+
+/**
+ * Call many commands and capture output - dyadic.
+ *
+ * On array,number - runs each command of the array, like kute, with at most
+ * the given number of them running at once. Leaves an array of the outputs
+ * followed by an array of the exit statuses, both in the order of the
+ * commands. A command's output is collected as soon as it closes it, whatever
+ * the others are still doing.
+ * On *,* - domain error.
+ */
+static Error native_kulupu(ValueArray* stack) {
+    if (stack->count < 2) return ERROR_STACK_UNDERFLOW;
+    Error result = stack_force_budgeted(stack, 2);
+    if (ERROR_OK != result) return result;
+
+    Value* a = &stack->elements[stack->count - 2];
+    Value* b = &stack->elements[stack->count - 1];
+
+    if (VALUE_ARRAY != a->type || VALUE_NUMBER != b->type || b->as_number < 1) return ERROR_DOMAIN;
+
+    size_t count = a->as_array.count;
+    size_t limit = b->as_number < (float64_t)count ? (size_t)b->as_number : count;
+
+    CommandLine*   command_lines = interpreter_allocate(count * sizeof(CommandLine), "jobs");
+    Job*           jobs          = interpreter_allocate(limit * sizeof(Job), "jobs");
+    struct pollfd* fds           = interpreter_allocate(limit * sizeof(struct pollfd), "jobs");
+
+    for (size_t i = 0; i < count; ++i) {
+        if (!command_line_make(&a->as_array.elements[i], &command_lines[i])) {
+            for (size_t j = 0; j < i; ++j) command_line_free(&command_lines[j]);
+            interpreter_free(command_lines);
+            interpreter_free(jobs);
+            interpreter_free(fds);
+            return ERROR_DOMAIN;
+        }
+    }
+
+    Value outputs = {
+        .type     = VALUE_ARRAY,
+        .as_array = {0}
+    };
+    Value statuses = {
+        .type     = VALUE_ARRAY,
+        .as_array = {0}
+    };
+    ARRAY_RESIZE(&outputs.as_array,  &interpreter->allocator, count);
+    ARRAY_RESIZE(&statuses.as_array, &interpreter->allocator, count);
+    outputs.as_array.count  = count;
+    statuses.as_array.count = count;
+
+    for (size_t i = 0; i < count; ++i) {
+        outputs.as_array.elements[i]  = (Value){ .type = VALUE_ARRAY,  .as_array  = {0} };
+        statuses.as_array.elements[i] = (Value){ .type = VALUE_NUMBER, .as_number = 127 };
+    }
+
+    size_t next    = 0;
+    size_t running = 0;
+    while (next < count || 0 != running) {
+        // Starts commands up to the limit. The ones that fail to start keep
+        // the empty output and status 127.
+        while (next < count && running < limit) {
+            size_t index = next++;
+
+            // The pipes have to be close-on-exec from the start, otherwise
+            // commands started later hold on to the write ends of the ones
+            // before them, and those never see end of file until every
+            // command after them has finished. Only the read end is made
+            // non-blocking, since the write end is the command's stdout.
+            int pipe_fds[2];
+            if (!pipe_make(pipe_fds)) continue;
+            (void)fcntl(pipe_fds[0], F_SETFL, O_NONBLOCK);
+
+            pid_t pid;
+            bool  spawned = command_spawn(&command_lines[index], pipe_fds[1], &pid);
+            (void)close(pipe_fds[1]);
+            if (!spawned) {
+                (void)close(pipe_fds[0]);
+                continue;
+            }
+
+            jobs[running] = (Job){ .pid = pid, .index = index };
+            fds[running]  = (struct pollfd){ .fd = pipe_fds[0], .events = POLLIN };
+            ++running;
+        }
+
+        if (0 == running) continue;
+
+        if (poll(fds, (nfds_t)running, -1) < 0) {
+            if (EINTR == errno) continue;
+            // Shouldn't happen; read the rest without waiting on the others.
+            for (size_t i = 0; i < running; ++i) fds[i].revents = POLLIN;
+        }
+
+        for (size_t i = 0; i < running;) {
+            if (0 == fds[i].revents) {
+                ++i;
+                continue;
+            }
+
+            size_t index = jobs[i].index;
+            if (read_characters(fds[i].fd, &outputs.as_array.elements[index].as_array)) {
+                ++i;
+                continue;
+            }
+
+            (void)close(fds[i].fd);
+            statuses.as_array.elements[index].as_number = command_wait(jobs[i].pid);
+
+            --running;
+            jobs[i] = jobs[running];
+            fds[i]  = fds[running];
+        }
+    }
+
+    for (size_t i = 0; i < count; ++i) command_line_free(&command_lines[i]);
+    interpreter_free(command_lines);
+    interpreter_free(jobs);
+    interpreter_free(fds);
+
+    value_free(a);
+    *a = outputs;
+    *b = statuses;
+
+    return ERROR_OK;
+}
+
+/*
+ * Parallelism.
+ *
+ * The thread pool is shared by every interpreter, so it's bookkeeping, like the
+ * task deques, is allocated with the C standard library instead of any one
+ * interpreter's allocator.
+ */
+
+// Set on threads taking part in a parallel_for so that nested parallel work
+// runs inline instead of waiting on the pool from inside of it, and so that
+// the program isn't rewritten while other threads are running it.
+static _Thread_local bool parallel_worker = false;
+
+/**
+ * A call to parallel_for that is in progress.
+ */
+typedef struct {
+    void          (*body)(void*, size_t, size_t);
+    void*          context;
+    // Interpreter of the thread that called parallel_for.
+    Interpreter*   interpreter;
+    size_t         chunk_size;
+    // Elements that haven't been processed yet.
+    _Atomic size_t remaining;
+    // Whether chunks are skipped once the interpreter's deadline has passed,
+    // and if any were.
+    bool           budgeted;
+    _Atomic bool   expired;
+} ParallelFor;
+
+/**
+ * A range of elements of a parallel_for that have yet to be processed.
+ */
+typedef struct {
+    ParallelFor* parallel_for;
+    size_t       start;
+    size_t       end;
+} ParallelTask;
+
+typedef ARRAY_OF(ParallelTask) ParallelTaskArray;
+
+/**
+ * The owner pushes and pops tasks at the back, while other threads steal from
+ * the front, which has the biggest ranges.
+ */
+typedef struct {
+    pthread_mutex_t   lock;
+    ParallelTaskArray tasks;
+    // Index of the first task that hasn't been stolen.
+    size_t            front;
+} TaskDeque;
+
+/**
+ * Threads that run the parallel_for tasks. Every worker has it's own deque,
+ * and there is one more shared by the threads outside of the pool that call
+ * parallel_for.
+ */
+typedef struct {
+    size_t          worker_count;
+    TaskDeque*      deques;
+    // Tasks in all of the deques.
+    _Atomic size_t  pending;
+    _Atomic size_t  sleeping;
+    pthread_mutex_t lock;
+    // Signaled when tasks are pushed.
+    pthread_cond_t  work;
+    // Broadcast when a parallel_for finishes.
+    pthread_cond_t  done;
+} ThreadPool;
+
+// How many threads process arrays in parallel, including the calling thread.
+// 0 means one per processor. Can only be changed until the pool is started.
+static _Atomic size_t  thread_count        = 0;
+static pthread_mutex_t thread_count_lock   = PTHREAD_MUTEX_INITIALIZER;
+static bool            thread_pool_started = false;
+
+static ThreadPool     thread_pool;
+static pthread_once_t thread_pool_once = PTHREAD_ONCE_INIT;
+
+// Index of the deque the thread pushes it's tasks to. Threads outside of the
+// pool use the shared deque.
+static _Thread_local size_t thread_pool_deque = SIZE_MAX;
+
+static void task_deque_push(TaskDeque* deque, ParallelTask task) {
+    (void)pthread_mutex_lock(&deque->lock);
+    if (deque->front == deque->tasks.count) {
+        deque->front       = 0;
+        deque->tasks.count = 0;
+    }
+    ARRAY_APPEND(&deque->tasks, &array_stdlib_allocator, task);
+    (void)pthread_mutex_unlock(&deque->lock);
+
+    atomic_fetch_add(&thread_pool.pending, 1);
+    if (0 != atomic_load(&thread_pool.sleeping)) {
+        (void)pthread_mutex_lock(&thread_pool.lock);
+        (void)pthread_cond_signal(&thread_pool.work);
+        (void)pthread_mutex_unlock(&thread_pool.lock);
+    }
+}
+
+static bool task_deque_pop(TaskDeque *restrict deque, bool steal, ParallelTask *restrict task) {
+    (void)pthread_mutex_lock(&deque->lock);
+    bool found = deque->front != deque->tasks.count;
+    if (found) {
+        if (steal) *task = deque->tasks.elements[deque->front++];
+        else       *task = deque->tasks.elements[--deque->tasks.count];
+    }
+    (void)pthread_mutex_unlock(&deque->lock);
+
+    if (found) atomic_fetch_sub(&thread_pool.pending, 1);
+    return found;
+}
+
+/**
+ * Takes a task from the thread's own deque, or else steals one from another.
+ */
+static bool thread_pool_find_task(ParallelTask* task) {
+    size_t deque_count = thread_pool.worker_count + 1;
+    if (task_deque_pop(&thread_pool.deques[thread_pool_deque], false, task)) return true;
+
+    for (size_t i = 1; i < deque_count; ++i) {
+        size_t victim = (thread_pool_deque + i) % deque_count;
+        if (task_deque_pop(&thread_pool.deques[victim], true, task)) return true;
+    }
+    return false;
+}
+
+/**
+ * Processes the task, leaving the second half of it for other threads to steal
+ * while it's bigger than a chunk.
+ */
+static void thread_pool_run_task(ParallelTask task) {
+    ParallelFor* parallel_for = task.parallel_for;
+
+    while (task.end - task.start > parallel_for->chunk_size) {
+        size_t middle = task.start + (task.end - task.start) / 2;
+        task_deque_push(&thread_pool.deques[thread_pool_deque], (ParallelTask){
+            .parallel_for = parallel_for,
+            .start        = middle,
+            .end          = task.end
+        });
+        task.end = middle;
+    }
+
+    Interpreter* previous_interpreter = interpreter;
+    interpreter = parallel_for->interpreter;
+    if (parallel_for->budgeted && budget_expired()) {
+        atomic_store_explicit(&parallel_for->expired, true, memory_order_relaxed);
+    } else {
+        parallel_for->body(parallel_for->context, task.start, task.end);
+    }
+    interpreter = previous_interpreter;
+
+    size_t count = task.end - task.start;
+    if (count == atomic_fetch_sub(&parallel_for->remaining, count)) {
+        (void)pthread_mutex_lock(&thread_pool.lock);
+        (void)pthread_cond_broadcast(&thread_pool.done);
+        (void)pthread_mutex_unlock(&thread_pool.lock);
+    }
+}
+
+static void* thread_pool_worker(void* deque) {
+    parallel_worker   = true;
+    thread_pool_deque = (size_t)(uintptr_t)deque;
+
+    for (;;) {
+        ParallelTask task;
+        if (thread_pool_find_task(&task)) {
+            thread_pool_run_task(task);
+            continue;
+        }
+
+        (void)pthread_mutex_lock(&thread_pool.lock);
+        atomic_fetch_add(&thread_pool.sleeping, 1);
+        while (0 == atomic_load(&thread_pool.pending)) {
+            (void)pthread_cond_wait(&thread_pool.work, &thread_pool.lock);
+        }
+        atomic_fetch_sub(&thread_pool.sleeping, 1);
+        (void)pthread_mutex_unlock(&thread_pool.lock);
+    }
+
+    return NULL;
+}
+
+/**
+ * Gets how many threads the pool has, or will have once started, including the
+ * threads that call parallel_for.
+ */
+static size_t thread_pool_size(void) {
+    size_t threads = atomic_load(&thread_count);
+    if (0 != threads) return threads;
+
+    long processors = sysconf(_SC_NPROCESSORS_ONLN);
+    return processors < 1 ? 1 : (size_t)processors;
+}
+
+/**
+ * Sets how many threads the pool will have, with 0 for one per processor.
+ * Returns false if it's already been started, since it keeps the threads it
+ * started with.
+ */
+static bool thread_pool_set_size(size_t threads) {
+    (void)pthread_mutex_lock(&thread_count_lock);
+    bool set = !thread_pool_started;
+    if (set) atomic_store(&thread_count, threads);
+    (void)pthread_mutex_unlock(&thread_count_lock);
+    return set;
+}
+
+static void thread_pool_start(void) {
+    (void)pthread_mutex_lock(&thread_count_lock);
+    thread_pool_started = true;
+    size_t threads = thread_pool_size();
+    (void)pthread_mutex_unlock(&thread_count_lock);
+
+    thread_pool.worker_count = threads - 1;
+    thread_pool.deques       = calloc(threads, sizeof(TaskDeque));
+    if (NULL == thread_pool.deques) {
+        (void)fputs("Error: Unable to allocate thread pool; buy more RAM lol", stderr);
+        exit(1);
+    }
+    for (size_t i = 0; i < threads; ++i) {
+        (void)pthread_mutex_init(&thread_pool.deques[i].lock, NULL);
+    }
+    (void)pthread_mutex_init(&thread_pool.lock, NULL);
+    (void)pthread_cond_init(&thread_pool.work, NULL);
+    (void)pthread_cond_init(&thread_pool.done, NULL);
+
+    for (size_t i = 0; i < thread_pool.worker_count; ++i) {
+        pthread_t thread;
+        if (0 != pthread_create(&thread, NULL, &thread_pool_worker, (void*)(uintptr_t)i)) {
+            thread_pool.worker_count = i;
+            break;
+        }
+        (void)pthread_detach(thread);
+    }
+}
+
+/**
+ * Runs a parallel_for, returning false if chunks were skipped because it's
+ * budgeted and the deadline passed.
+ */
+static bool parallel_for_run( size_t count
+                            , size_t chunk_size
+                            , void(*body)(void*, size_t, size_t)
+                            , void* context
+                            , bool budgeted) {
+    if (0 == count) return true;
+
+    if (!parallel_worker) (void)pthread_once(&thread_pool_once, &thread_pool_start);
+    if (parallel_worker || 0 == thread_pool.worker_count || count <= chunk_size) {
+        if (!budgeted) {
+            body(context, 0, count);
+            return true;
+        }
+
+        for (size_t start = 0; start < count; start += chunk_size) {
+            if (budget_expired()) return false;
+            body(context, start, count - start < chunk_size ? count : start + chunk_size);
+        }
+        return true;
+    }
+
+    ParallelFor parallel_for = {
+        .body        = body,
+        .context     = context,
+        .interpreter = interpreter,
+        .chunk_size  = chunk_size,
+        .remaining   = count,
+        .budgeted    = budgeted,
+        .expired     = false
+    };
+
+    // The shared deque goes last.
+    if (thread_pool_deque > thread_pool.worker_count) thread_pool_deque = thread_pool.worker_count;
+
+    parallel_worker = true;
+    thread_pool_run_task((ParallelTask){
+        .parallel_for = &parallel_for,
+        .start        = 0,
+        .end          = count
+    });
+
+    // Helps out with whatever is left, then waits for the stragglers.
+    while (0 != atomic_load(&parallel_for.remaining)) {
+        ParallelTask task;
+        if (thread_pool_find_task(&task)) {
+            thread_pool_run_task(task);
+            continue;
+        }
+
+        (void)pthread_mutex_lock(&thread_pool.lock);
+        while (0 != atomic_load(&parallel_for.remaining) && 0 == atomic_load(&thread_pool.pending)) {
+            (void)pthread_cond_wait(&thread_pool.done, &thread_pool.lock);
+        }
+        (void)pthread_mutex_unlock(&thread_pool.lock);
+    }
+    parallel_worker = false;
+
+    return !atomic_load(&parallel_for.expired);
+}
+
+/**
+ * Calls body(context, start, end) over the range [0, count) in chunks of
+ * chunk_size, spread out across the thread pool. The calling thread takes part
+ * in the work and returns once all chunks are done.
+ */
+static void parallel_for( size_t count
+                        , size_t chunk_size
+                        , void(*body)(void*, size_t, size_t)
+                        , void* context) {
+    (void)parallel_for_run(count, chunk_size, body, context, false);
+}
+
+/**
+ * Like parallel_for, but once the current interpreter's deadline passes the
+ * chunks that haven't started are skipped, and ERROR_TIMED_OUT is returned.
+ */
+static Error parallel_for_budgeted( size_t count
+                                  , size_t chunk_size
+                                  , void(*body)(void*, size_t, size_t)
+                                  , void* context) {
+    return parallel_for_run(count, chunk_size, body, context, true) ? ERROR_OK : ERROR_TIMED_OUT;
+}
+
+
+
+/*
+ * Lazy evaluation.
+ *
+ * When enabled, arithmetic on flat numeric arrays pushes an expression node
+ * instead of computing the result. The nodes form a DAG that is only evaluated
+ * once something needs the actual value, such as a non-arithmetic native or
+ * dumping the stack. Forcing compiles the DAG into a list of instructions,
+ * merging identical subexpressions, and then evaluates it block-by-block so no
+ * intermediate arrays are ever created. The only other saving is that values
+ * dropped without being forced never get evaluated; nothing is done about the
+ * code that computed them.
+ *
+ * Nodes are only created once both operands are known to be compatible, so the
+ * only way forcing a lazy value can fail is by running out of time. Forcing
+ * while the program runs goes through the budgeted variants, which give up once
+ * the deadline passes and leave the value lazy.
+ */
+
+struct LazyNode {
+    _Atomic size_t refs;
+    // NULL for leaves.
+    float64_t   (*operation)(float64_t, float64_t);
+    LazyNode*   operands[2];
+    // Value of a leaf, either a number or flat array of numbers.
+    Value       leaf;
+    // Number of elements in the result. Only used for non-leaves, which are
+    // always arrays.
+    size_t      count;
+    // Instruction the node was compiled to while forcing, else SIZE_MAX.
+    size_t      slot;
+};
+
+static void lazy_node_retain(LazyNode* node) {
+    atomic_fetch_add_explicit(&node->refs, 1, memory_order_relaxed);
+}
+
+static void lazy_node_release(LazyNode* node) {
+    if (1 != atomic_fetch_sub_explicit(&node->refs, 1, memory_order_acq_rel)) return;
+
+    if (NULL == node->operation) {
+        value_free(&node->leaf);
+    } else {
+        lazy_node_release(node->operands[0]);
+        lazy_node_release(node->operands[1]);
+    }
+    interpreter_free(node);
+}
+
+static LazyNode* lazy_node_allocate(void) {
+    LazyNode* node = interpreter_allocate(sizeof(LazyNode), "lazy expression");
+    (void)memset(node, 0, sizeof(LazyNode));
+    node->refs = 1;
+    node->slot = SIZE_MAX;
+    return node;
+}
+
+/**
+ * Checks if the value can be used in a lazy expression, getting whether it's
+ * an array and how many elements it has.
+ */
+static bool lazy_operand(const Value *restrict value, bool *restrict is_array, size_t *restrict count) {
+    switch (value->type) {
+    case VALUE_NUMBER: {
+        *is_array = false;
+        *count    = 1;
+    } break;
+
+    case VALUE_LAZY: {
+        LazyNode* node = value->as_lazy;
+        *is_array = NULL != node->operation || VALUE_ARRAY == node->leaf.type;
+        *count    = NULL != node->operation ? node->count : node->leaf.as_array.count;
+    } break;
+
+    case VALUE_ARRAY: {
+        for (size_t i = 0; i < value->as_array.count; ++i) {
+            if (VALUE_NUMBER != value->as_array.elements[i].type) return false;
+        }
+        *is_array = true;
+        *count    = value->as_array.count;
+    } break;
+
+    case VALUE_CHARACTER: return false;
+
+    default: assert(0 && "Unreachable");
+    }
+
+    return true;
+}
+
+/**
+ * Takes ownership of the value and turns it into an expression node.
+ */
+static LazyNode* lazy_wrap(Value value) {
+    if (VALUE_LAZY == value.type) return value.as_lazy;
+
+    LazyNode* node = lazy_node_allocate();
+    node->leaf = value;
+    return node;
+}
+
+/**
+ * Replaces the top two values of the stack with a lazy expression of the
+ * operation applied to them. Returns false, leaving the stack untouched, if
+ * the operation should be done eagerly instead.
+ */
+static bool lazy_numeric_dyadic(ValueArray* stack, float64_t(*operation)(float64_t,float64_t)) {
+    if (stack->count < 2) return false;
+
+    Value* a = &stack->elements[stack->count - 2];
+    Value* b = &stack->elements[stack->count - 1];
+
+    bool   a_is_array, b_is_array;
+    size_t a_count,    b_count;
+    if (!lazy_operand(a, &a_is_array, &a_count)) return false;
+    if (!lazy_operand(b, &b_is_array, &b_count)) return false;
+    // Scalar arithmetic is cheaper to just do.
+    if (!a_is_array && !b_is_array) return false;
+    // Let the eager path report the shape error.
+    if (a_is_array && b_is_array && a_count != b_count) return false;
+
+    LazyNode* node = lazy_node_allocate();
+    node->operation   = operation;
+    node->operands[0] = lazy_wrap(*a);
+    node->operands[1] = lazy_wrap(*b);
+    node->count       = a_is_array ? a_count : b_count;
+
+    a->type    = VALUE_LAZY;
+    a->as_lazy = node;
+    --stack->count;
+
+    return true;
+}
+
+typedef enum {
+    LAZY_LOAD_NUMBER,
+    LAZY_LOAD_ARRAY,
+    LAZY_ADD,
+    LAZY_SUBTRACT,
+    LAZY_MULTIPLY,
+    LAZY_DIVIDE,
+    LAZY_OPERATE
+} LazyOpcode;
+
+typedef struct {
+    LazyOpcode   opcode;
+    float64_t    number;
+    const Value* elements;
+    float64_t    (*operation)(float64_t, float64_t);
+    size_t       operands[2];
+} LazyInstruction;
+
+typedef ARRAY_OF(LazyInstruction)  LazyProgram;
+typedef ARRAY_OF(LazyNode*)        LazyNodePointerArray;
+
+static bool lazy_instructions_equal(const LazyInstruction* a, const LazyInstruction* b) {
+    if (a->opcode != b->opcode) return false;
+
+    switch (a->opcode) {
+    case LAZY_LOAD_NUMBER: return 0 == memcmp(&a->number, &b->number, sizeof(a->number));
+    case LAZY_LOAD_ARRAY:  return a->elements == b->elements;
+    case LAZY_OPERATE:     if (a->operation != b->operation) return false; // fallthrough
+    case LAZY_ADD:
+    case LAZY_SUBTRACT:
+    case LAZY_MULTIPLY:
+    case LAZY_DIVIDE:      return a->operands[0] == b->operands[0] && a->operands[1] == b->operands[1];
+    default:               assert(0 && "Unreachable");
+    }
+}
+
+/**
+ * Compiles the DAG into instructions in dependency order, returning the
+ * instruction that computes the node. Subexpressions that compute the same
+ * thing share an instruction.
+ */
+static size_t lazy_compile( LazyNode *restrict node
+                          , LazyProgram *restrict program
+                          , LazyNodePointerArray *restrict visited) {
+    if (SIZE_MAX != node->slot) return node->slot;
+
+    LazyInstruction instruction = {0};
+
+    if (NULL == node->operation) {
+        if (VALUE_NUMBER == node->leaf.type) {
+            instruction.opcode = LAZY_LOAD_NUMBER;
+            instruction.number = node->leaf.as_number;
+        } else {
+            instruction.opcode   = LAZY_LOAD_ARRAY;
+            instruction.elements = node->leaf.as_array.elements;
+        }
+    } else {
+        instruction.operands[0] = lazy_compile(node->operands[0], program, visited);
+        instruction.operands[1] = lazy_compile(node->operands[1], program, visited);
+        instruction.operation   = node->operation;
+
+        if      (node->operation == &native_pona_operation)   instruction.opcode = LAZY_ADD;
+        else if (node->operation == &native_ike_operation)    instruction.opcode = LAZY_SUBTRACT;
+        else if (node->operation == &native_mute_operation)   instruction.opcode = LAZY_MULTIPLY;
+        else if (node->operation == &native_kipisi_operation) instruction.opcode = LAZY_DIVIDE;
+        else                                                  instruction.opcode = LAZY_OPERATE;
+    }
+
+    size_t slot = program->count;
+    for (size_t i = 0; i < program->count; ++i) {
+        if (lazy_instructions_equal(&program->elements[i], &instruction)) {
+            slot = i;
+            break;
+        }
+    }
+    if (slot == program->count) {
+        ARRAY_APPEND(program, &interpreter->allocator, instruction);
+    }
+
+    node->slot = slot;
+    ARRAY_APPEND(visited, &interpreter->allocator, node);
+    return slot;
+}
+
+/**
+ * A compiled lazy expression being evaluated into an array.
+ */
+typedef struct {
+    const LazyProgram* program;
+    size_t             result_slot;
+    Value*             result;
+} LazyTask;
+
+static void lazy_task_body(void* context, size_t task_start, size_t task_end) {
+    const LazyTask*    task    = context;
+    const LazyProgram* program = task->program;
+
+    float64_t* registers = interpreter_allocate(
+        program->count * LAZY_BLOCK_SIZE * sizeof(float64_t),
+        "lazy evaluation registers"
+    );
+
+    for (size_t start = task_start; start < task_end; start += LAZY_BLOCK_SIZE) {
+        size_t block = task_end - start < LAZY_BLOCK_SIZE ? task_end - start : LAZY_BLOCK_SIZE;
+
+        for (size_t i = 0; i < program->count; ++i) {
+            const LazyInstruction* instruction = &program->elements[i];
+            float64_t*       out = &registers[i * LAZY_BLOCK_SIZE];
+            const float64_t* x   = &registers[instruction->operands[0] * LAZY_BLOCK_SIZE];
+            const float64_t* y   = &registers[instruction->operands[1] * LAZY_BLOCK_SIZE];
+
+            switch (instruction->opcode) {
+            case LAZY_LOAD_NUMBER: {
+                for (size_t k = 0; k < block; ++k) out[k] = instruction->number;
+            } break;
+            case LAZY_LOAD_ARRAY: {
+                const Value* elements = &instruction->elements[start];
+                for (size_t k = 0; k < block; ++k) out[k] = elements[k].as_number;
+            } break;
+            case LAZY_ADD:      for (size_t k = 0; k < block; ++k) out[k] = x[k] + y[k]; break;
+            case LAZY_SUBTRACT: for (size_t k = 0; k < block; ++k) out[k] = x[k] - y[k]; break;
+            case LAZY_MULTIPLY: for (size_t k = 0; k < block; ++k) out[k] = x[k] * y[k]; break;
+            case LAZY_DIVIDE:   for (size_t k = 0; k < block; ++k) out[k] = x[k] / y[k]; break;
+            case LAZY_OPERATE: {
+                for (size_t k = 0; k < block; ++k) out[k] = instruction->operation(x[k], y[k]);
+            } break;
+            default: assert(0 && "Unreachable");
+            }
+        }
+
+        const float64_t* out = &registers[task->result_slot * LAZY_BLOCK_SIZE];
+        for (size_t k = 0; k < block; ++k) {
+            Value* element = &task->result[start + k];
+            element->type      = VALUE_NUMBER;
+            element->as_number = out[k];
+        }
+    }
+
+    interpreter_free(registers);
+}
+
+/**
+ * Evaluates the non-leaf node and turns it into a leaf holding the result,
+ * letting go of it's operands. Large results are evaluated on multiple
+ * threads. If it's budgeted and the deadline passes, the node is left as it was
+ * and ERROR_TIMED_OUT is returned.
+ */
+static Error lazy_node_evaluate(LazyNode* node, bool budgeted) {
+    size_t count = node->count;
+    if (budgeted && ERROR_OK != budget_tick(count)) return ERROR_TIMED_OUT;
+
+    LazyProgram          program = {0};
+    LazyNodePointerArray visited = {0};
+    size_t result_slot = lazy_compile(node, &program, &visited);
+
+    Value evaluated = {
+        .type     = VALUE_ARRAY,
+        .as_array = {0}
+    };
+    ARRAY_RESIZE(&evaluated.as_array, &interpreter->allocator, count);
+    evaluated.as_array.count = count;
+
+    LazyTask task = {
+        .program     = &program,
+        .result_slot = result_slot,
+        .result      = evaluated.as_array.elements
+    };
+    bool finished = true;
+    if (count >= PARALLEL_THRESHOLD) {
+        finished = parallel_for_run(count, ELEMENTWISE_CHUNK_SIZE, &lazy_task_body, &task, budgeted);
+    } else {
+        lazy_task_body(&task, 0, count);
+    }
+
+    for (size_t i = 0; i < visited.count; ++i) visited.elements[i]->slot = SIZE_MAX;
+
+    ARRAY_FREE(&program, &interpreter->allocator);
+    ARRAY_FREE(&visited, &interpreter->allocator);
+
+    if (!finished) {
+        // Only ever has numbers written into it, so there's nothing inside to
+        // free.
+        ARRAY_FREE(&evaluated.as_array, &interpreter->allocator);
+        return ERROR_TIMED_OUT;
+    }
+
+    lazy_node_release(node->operands[0]);
+    lazy_node_release(node->operands[1]);
+    node->operation = NULL;
+    node->leaf      = evaluated;
+    return ERROR_OK;
+}
+
+/**
+ * Replaces the value with it's actual value if it's lazy. If it's budgeted and
+ * the deadline passes, the value is left lazy and ERROR_TIMED_OUT is returned.
+ */
+static Error value_force_run(Value* value, bool budgeted) {
+    if (VALUE_LAZY != value->type) return ERROR_OK;
+
+    LazyNode* node = value->as_lazy;
+    if (NULL != node->operation) {
+        Error result = lazy_node_evaluate(node, budgeted);
+        if (ERROR_OK != result) return result;
+    }
+
+    if (1 == atomic_load_explicit(&node->refs, memory_order_acquire)) {
+        // Only we have it, so we can take the result.
+        *value = node->leaf;
+        interpreter_free(node);
+    } else {
+        *value = value_deep_copy(&node->leaf);
+        lazy_node_release(node);
+    }
+    return ERROR_OK;
+}
+
+/**
+ * Forces the value however long it takes. Used once the program is done with
+ * it, such as when dumping the stack.
+ */
+static void value_force(Value* value) {
+    (void)value_force_run(value, false);
+}
+
+/**
+ * Forces the value while the program is running, giving up with
+ * ERROR_TIMED_OUT once the deadline passes.
+ */
+static Error value_force_budgeted(Value* value) {
+    return value_force_run(value, true);
+}
+
+/**
+ * Forces the top count values of the stack, or the whole stack if there aren't
+ * that many. Gives up with ERROR_TIMED_OUT once the deadline passes, leaving
+ * the values that weren't forced yet lazy.
+ */
+static Error stack_force_budgeted(ValueArray* stack, size_t count) {
+    size_t start = count < stack->count ? stack->count - count : 0;
+    for (size_t i = start; i < stack->count; ++i) {
+        Error result = value_force_budgeted(&stack->elements[i]);
+        if (ERROR_OK != result) return result;
+    }
+    return ERROR_OK;
+}
+
+
+
+/*
+ * Quickening.
+ *
+ * Natives that see the same operand types many times in a row switch over to a
+ * variant specialized for those types, which skips the generic type dispatch.
+ * The specialized variants check their operands first and return ERROR_GUARD
+ * if they don't match, at which point the interpreter goes back to the generic
+ * native and runs that instead.
+ *
+ * Sites run many times by the operators are what get quickened, like the mute
+ * in 10000 nanpa ( 2 mute ) wan, which only sees numbers. The type feedback is
+ * kept with atomics, so it still counts when the thread pool runs the
+ * operator.
+ */
+
+typedef enum {
+    QUICKEN_NUMBER_NUMBER,
+    // Flat array of numbers and a number.
+    QUICKEN_ARRAY_NUMBER,
+    QUICKEN_NUMBER_ARRAY,
+    QUICKEN_KIND_COUNT,
+    QUICKEN_KIND_NONE = QUICKEN_KIND_COUNT
+} QuickenKind;
+
+#define DEFINE_QUICKENED_NATIVES(native, operator)                              \
+    static Error native##_number_number(ValueArray* stack) {                    \
+        if (stack->count < 2) return ERROR_GUARD;                               \
+        Value* a = &stack->elements[stack->count - 2];                          \
+        Value* b = &stack->elements[stack->count - 1];                          \
+        if (VALUE_NUMBER != a->type || VALUE_NUMBER != b->type) {               \
+            return ERROR_GUARD;                                                 \
+        }                                                                       \
+        a->as_number = a->as_number operator b->as_number;                      \
+        --stack->count;                                                         \
+        return ERROR_OK;                                                        \
+    }                                                                           \
+                                                                                \
+    static Error native##_array_number(ValueArray* stack) {                     \
+        if (stack->count < 2) return ERROR_GUARD;                               \
+        Value* a = &stack->elements[stack->count - 2];                          \
+        Value* b = &stack->elements[stack->count - 1];                          \
+        if (VALUE_ARRAY != a->type || VALUE_NUMBER != b->type) {                \
+            return ERROR_GUARD;                                                 \
+        }                                                                       \
+        Value* elements = a->as_array.elements;                                 \
+        for (size_t i = 0; i < a->as_array.count; ++i) {                        \
+            if (VALUE_NUMBER != elements[i].type) return ERROR_GUARD;           \
+        }                                                                       \
+        if (a->as_array.count >= PARALLEL_THRESHOLD) {                          \
+            NumericDyadicTask task = {                                          \
+                .operation = &native##_operation,                               \
+                .a = elements, .b = b, .a_stride = 1, .b_stride = 0,            \
+                .result = elements                                              \
+            };                                                                  \
+            Error result = numeric_dyadic_flat(&task, a->as_array.count);       \
+            if (ERROR_OK != result) return result;                              \
+        } else {                                                                \
+            for (size_t i = 0; i < a->as_array.count; ++i) {                    \
+                elements[i].as_number = elements[i].as_number operator b->as_number; \
+            }                                                                   \
+        }                                                                       \
+        --stack->count;                                                         \
+        return ERROR_OK;                                                        \
+    }                                                                           \
+                                                                                \
+    static Error native##_number_array(ValueArray* stack) {                     \
+        if (stack->count < 2) return ERROR_GUARD;                               \
+        Value* a = &stack->elements[stack->count - 2];                          \
+        Value* b = &stack->elements[stack->count - 1];                          \
+        if (VALUE_NUMBER != a->type || VALUE_ARRAY != b->type) {                \
+            return ERROR_GUARD;                                                 \
+        }                                                                       \
+        Value* elements = b->as_array.elements;                                 \
+        for (size_t i = 0; i < b->as_array.count; ++i) {                        \
+            if (VALUE_NUMBER != elements[i].type) return ERROR_GUARD;           \
+        }                                                                       \
+        if (b->as_array.count >= PARALLEL_THRESHOLD) {                          \
+            NumericDyadicTask task = {                                          \
+                .operation = &native##_operation,                               \
+                .a = a, .b = elements, .a_stride = 0, .b_stride = 1,            \
+                .result = elements                                              \
+            };                                                                  \
+            Error result = numeric_dyadic_flat(&task, b->as_array.count);       \
+            if (ERROR_OK != result) return result;                              \
+        } else {                                                                \
+            for (size_t i = 0; i < b->as_array.count; ++i) {                    \
+                elements[i].as_number = a->as_number operator elements[i].as_number; \
+            }                                                                   \
+        }                                                                       \
+        *a = *b;                                                                \
+        --stack->count;                                                         \
+        return ERROR_OK;                                                        \
+    }
+
+DEFINE_QUICKENED_NATIVES(native_pona,   +)
+DEFINE_QUICKENED_NATIVES(native_ike,    -)
+DEFINE_QUICKENED_NATIVES(native_mute,   *)
+DEFINE_QUICKENED_NATIVES(native_kipisi, /)
+
+typedef struct {
+    Error(*generic)(ValueArray*);
+    Error(*specialized[QUICKEN_KIND_COUNT])(ValueArray*);
+} QuickenEntry;
+
+#define QUICKENED_NATIVES(native) \
+    { &native, { &native##_number_number, &native##_array_number, &native##_number_array } }
+
+static const QuickenEntry quicken_table[] = {
+    QUICKENED_NATIVES(native_pona),
+    QUICKENED_NATIVES(native_ike),
+    QUICKENED_NATIVES(native_mute),
+    QUICKENED_NATIVES(native_kipisi)
+};
+#define QUICKEN_TABLE_SIZE (sizeof(quicken_table)/sizeof(quicken_table[0]))
+
+// Values of Function.quicken_entry before the index into quicken_table.
+#define QUICKEN_ENTRY_UNKNOWN 0
+#define QUICKEN_ENTRY_NONE    1
+#define QUICKEN_ENTRY_FIRST   2
+
+static QuickenKind quicken_kind(const ValueArray* stack) {
+    if (stack->count < 2) return QUICKEN_KIND_NONE;
+
+    ValueType a = stack->elements[stack->count - 2].type;
+    ValueType b = stack->elements[stack->count - 1].type;
+
+    if (VALUE_NUMBER == a && VALUE_NUMBER == b) return QUICKEN_NUMBER_NUMBER;
+    if (VALUE_ARRAY  == a && VALUE_NUMBER == b) return QUICKEN_ARRAY_NUMBER;
+    if (VALUE_NUMBER == a && VALUE_ARRAY  == b) return QUICKEN_NUMBER_ARRAY;
+    return QUICKEN_KIND_NONE;
+}
+
+/**
+ * Records the operand types the native is about to be called with, quickening
+ * it once they've been the same QUICKEN_THRESHOLD times in a row.
+ */
+static void native_observe(Function *restrict function, const ValueArray *restrict stack) {
+    // Lazy values need to go through the generic natives.
+    if (!interpreter->quicken_enabled || interpreter->lazy_enabled) return;
+
+    // Other threads may be observing the same function, so the counts can come
+    // out a little off, which only changes when it's quickened.
+    uint8_t entry = atomic_load_explicit(&function->quicken_entry, memory_order_relaxed);
+    if (QUICKEN_ENTRY_UNKNOWN == entry) {
+        entry = QUICKEN_ENTRY_NONE;
+        for (size_t i = 0; i < QUICKEN_TABLE_SIZE; ++i) {
+            if (quicken_table[i].generic == function->as_native) {
+                entry = (uint8_t)(QUICKEN_ENTRY_FIRST + i);
+                break;
+            }
+        }
+        atomic_store_explicit(&function->quicken_entry, entry, memory_order_relaxed);
+    }
+    if (QUICKEN_ENTRY_NONE == entry) return;
+    if (0 != atomic_load_explicit(&function->quicken_active, memory_order_relaxed)) return;
+
+    QuickenKind kind = quicken_kind(stack);
+    if (QUICKEN_KIND_NONE == kind || kind != atomic_load_explicit(&function->quicken_kind, memory_order_relaxed)) {
+        atomic_store_explicit(&function->quicken_kind,   (uint8_t)kind, memory_order_relaxed);
+        atomic_store_explicit(&function->quicken_streak, 1,             memory_order_relaxed);
+        return;
+    }
+
+    uint8_t streak = (uint8_t)(atomic_load_explicit(&function->quicken_streak, memory_order_relaxed) + 1);
+    atomic_store_explicit(&function->quicken_streak, streak, memory_order_relaxed);
+    if (streak >= QUICKEN_THRESHOLD) {
+        atomic_store_explicit(&function->quicken_streak, 0,                   memory_order_relaxed);
+        atomic_store_explicit(&function->quicken_active, (uint8_t)(kind + 1), memory_order_release);
+    }
+}
+
+/**
+ * Calls the native, or it's specialized variant if it's been quickened. If the
+ * specialized variant's guard fails, the native goes back to being generic.
+ */
+static Error native_call(Function *restrict function, ValueArray *restrict stack) {
+    native_observe(function, stack);
+
+    uint8_t active = atomic_load_explicit(&function->quicken_active, memory_order_acquire);
+    if (0 == active) return function->as_native(stack);
+
+    const QuickenEntry* entry = &quicken_table[
+        atomic_load_explicit(&function->quicken_entry, memory_order_relaxed) - QUICKEN_ENTRY_FIRST
+    ];
+    Error result = entry->specialized[active - 1](stack);
+    if (ERROR_GUARD != result) return result;
+
+    atomic_store_explicit(&function->quicken_active, 0,                 memory_order_relaxed);
+    atomic_store_explicit(&function->quicken_kind,   QUICKEN_KIND_NONE, memory_order_relaxed);
+    atomic_store_explicit(&function->quicken_streak, 0,                 memory_order_relaxed);
+    return function->as_native(stack);
+}
+
+
+
+/**
+ * Inlining pass.
+ *
+ * Splices the bodies of defuns with at most INLINE_BUDGET functions directly
+ * into their callers, removing the call overhead and exposing the whole
+ * sequence of natives to the JIT.
+ */
+static void inline_defuns(FunctionArray* functions) {
+    FunctionArray inlined = {0};
+    ARRAY_RESIZE(&inlined, &interpreter->allocator, functions->count);
+
+    for (size_t i = 0; i < functions->count; ++i) {
+        Function function = functions->elements[i];
+
+        if (FUNCTION_DEFUN == function.type) {
+            Defun* defun = &function.as_defun;
+
+            // Inlines from the bottom up so that small defuns made out of other
+            // small defuns flatten all the way.
+            inline_defuns(&defun->functions);
+
+            if (defun->functions.count <= INLINE_BUDGET) {
+                for (size_t k = 0; k < defun->functions.count; ++k) {
+                    ARRAY_APPEND(
+                        &inlined,
+                        &interpreter->allocator,
+                        defun->functions.elements[k]
+                    );
+                }
+                ARRAY_FREE(&defun->functions, &interpreter->allocator);
+                jit_code_free(&defun->jit_code);
+                continue;
+            }
+        }
+
+        // The body of an operator stays a whole defun, so each application is
+        // still a call that can be JIT compiled and memoized. Only the defuns
+        // inside of it get inlined.
+        if (FUNCTION_EACH == function.type || FUNCTION_RANK == function.type) {
+            Function* body = &function.as_operator.functions.elements[0];
+            inline_defuns(&body->as_defun.functions);
+        }
+
+        ARRAY_APPEND(&inlined, &interpreter->allocator, function);
+    }
+
+    ARRAY_SWAP(functions, &inlined);
+    ARRAY_FREE(&inlined, &interpreter->allocator);
+}
+
+
+
+/*
+ * x86-64 JIT.
+ *
+ * Hot defuns are compiled by stitching together pre-assembled machine code
+ * templates, one per function in the body, and patching in the addresses of
+ * the natives, literals, and helpers they call. The generated code keeps the
+ * stack pointer in rbx and bails out to the epilogue as soon as a call returns
+ * an error, so it behaves exactly like the interpreter. Natives are called
+ * through native_call, like the interpreter does, so they still get quickened.
+ *
+ * Only leaf defuns are compiled. Calls to other defuns are left to the
+ * interpreter's call stack so that nested defuns never eat into the C stack.
+ */
+
+#ifdef TLPIN_JIT
+
+// push rbx; mov rbx, rdi
+static const uint8_t jit_template_prologue[] = { 0x53, 0x48, 0x89, 0xFB };
+
+// mov rdi, rbx; mov rsi, <argument>; mov rax, <function>; call rax;
+// test eax, eax; jnz <exit>
+static const uint8_t jit_template_call_with_argument[] = {
+    0x48, 0x89, 0xDF,
+    0x48, 0xBE, 0, 0, 0, 0, 0, 0, 0, 0,
+    0x48, 0xB8, 0, 0, 0, 0, 0, 0, 0, 0,
+    0xFF, 0xD0,
+    0x85, 0xC0,
+    0x0F, 0x85, 0, 0, 0, 0
+};
+#define JIT_CALL_WITH_ARGUMENT_ARGUMENT_HOLE 5
+#define JIT_CALL_WITH_ARGUMENT_FUNCTION_HOLE 15
+#define JIT_CALL_WITH_ARGUMENT_EXIT_HOLE     29
+
+// xor eax, eax
+static const uint8_t jit_template_return_ok[] = { 0x31, 0xC0 };
+
+// exit: pop rbx; ret
+static const uint8_t jit_template_epilogue[] = { 0x5B, 0xC3 };
+
+static Error jit_push_literal(ValueArray* stack, const Value* literal) {
+    ARRAY_APPEND(stack, &interpreter->allocator, value_deep_copy(literal));
+    return ERROR_OK;
+}
+
+static Error jit_call_native(ValueArray* stack, Function* function) {
+    return native_call(function, stack);
+}
+
+static void jit_patch_address(uint8_t* hole, uintptr_t address) {
+    uint64_t value = (uint64_t)address;
+    (void)memcpy(hole, &value, sizeof(value));
+}
+
+/**
+ * Attempts to compile the body of the defun into native code. Returns false if
+ * the body contains anything the JIT doesn't support, in which case the defun
+ * should stay on the interpreter.
+ */
+static bool jit_compile_defun(Defun* defun) {
+    const FunctionArray* functions = &defun->functions;
+
+    size_t size = sizeof(jit_template_prologue)
+                + functions->count * sizeof(jit_template_call_with_argument)
+                + sizeof(jit_template_return_ok)
+                + sizeof(jit_template_epilogue);
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    size = (size + page_size - 1) / page_size * page_size;
+
+    void* memory = mmap(
+        NULL, size,
+        PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+        -1, 0
+    );
+    if (MAP_FAILED == memory) return false;
+
+    uint8_t* code   = memory;
+    size_t   offset = 0;
+    // Offsets of the jnz displacements that need to point at the epilogue. On
+    // the heap, since defuns can be arbitrarily long.
+    ARRAY_OF(size_t) exit_holes = {0};
+    ARRAY_RESIZE(&exit_holes, &interpreter->allocator, functions->count);
+
+#define JIT_EMIT(template)                                          \
+    do {                                                            \
+        (void)memcpy(code + offset, (template), sizeof(template));  \
+        offset += sizeof(template);                                 \
+    } while (0)
+
+    JIT_EMIT(jit_template_prologue);
+
+    for (size_t i = 0; i < functions->count; ++i) {
+        const Function* function = &functions->elements[i];
+        size_t start = offset;
+
+        switch (function->type) {
+        case FUNCTION_NATIVE: {
+            JIT_EMIT(jit_template_call_with_argument);
+            jit_patch_address(
+                code + start + JIT_CALL_WITH_ARGUMENT_ARGUMENT_HOLE,
+                (uintptr_t)function
+            );
+            jit_patch_address(
+                code + start + JIT_CALL_WITH_ARGUMENT_FUNCTION_HOLE,
+                (uintptr_t)&jit_call_native
+            );
+            exit_holes.elements[exit_holes.count++] = start + JIT_CALL_WITH_ARGUMENT_EXIT_HOLE;
+        } break;
+
+        case FUNCTION_LITERAL: {
+            JIT_EMIT(jit_template_call_with_argument);
+            jit_patch_address(
+                code + start + JIT_CALL_WITH_ARGUMENT_ARGUMENT_HOLE,
+                (uintptr_t)&function->as_literal
+            );
+            jit_patch_address(
+                code + start + JIT_CALL_WITH_ARGUMENT_FUNCTION_HOLE,
+                (uintptr_t)&jit_push_literal
+            );
+            exit_holes.elements[exit_holes.count++] = start + JIT_CALL_WITH_ARGUMENT_EXIT_HOLE;
+        } break;
+
+        // Unsupported, so the defun falls back to the interpreter.
+        case FUNCTION_DEFUN:
+        case FUNCTION_EACH:
+        case FUNCTION_RANK:
+        case FUNCTION_FORK:
+        default: {
+            ARRAY_FREE(&exit_holes, &interpreter->allocator);
+            (void)munmap(memory, size);
+            return false;
+        }
+        }
+    }
+
+    JIT_EMIT(jit_template_return_ok);
+    size_t exit = offset;
+    JIT_EMIT(jit_template_epilogue);
+
+#undef JIT_EMIT
+
+    for (size_t i = 0; i < exit_holes.count; ++i) {
+        size_t  hole         = exit_holes.elements[i];
+        int32_t displacement = (int32_t)(exit - (hole + sizeof(int32_t)));
+        (void)memcpy(code + hole, &displacement, sizeof(displacement));
+    }
+    ARRAY_FREE(&exit_holes, &interpreter->allocator);
+
+    if (0 != mprotect(memory, size, PROT_READ | PROT_EXEC)) {
+        (void)munmap(memory, size);
+        return false;
+    }
+
+    defun->jit_code.entry  = (Error(*)(ValueArray*))(uintptr_t)memory;
+    defun->jit_code.memory = memory;
+    defun->jit_code.size   = size;
+    return true;
+}
+
+static void jit_code_free(JitCode* code) {
+    if (NULL != code->memory) (void)munmap(code->memory, code->size);
+    code->entry  = NULL;
+    code->memory = NULL;
+    code->size   = 0;
+}
+
+#else // TLPIN_JIT
+
+static bool jit_compile_defun(Defun* defun) {
+    (void)defun;
+    return false;
+}
+
+static void jit_code_free(JitCode* code) {
+    (void)code;
+}
+
+#endif // TLPIN_JIT
+
+/**
+ * Returns true if the defun should be run with it's JIT compiled code,
+ * compiling it first if it has just gotten hot.
+ */
+static bool jit_ready(Defun* defun) {
+    JitState state = atomic_load_explicit(&defun->jit_state, memory_order_acquire);
+    if (JIT_COMPILED == state) return true;
+    if (!interpreter->jit_enabled || JIT_COLD != state) return false;
+
+    // The count doesn't need to be exact, so a racy increment is fine.
+    size_t call_count = atomic_load_explicit(&defun->call_count, memory_order_relaxed) + 1;
+    atomic_store_explicit(&defun->call_count, call_count, memory_order_relaxed);
+    if (call_count < JIT_HOT_THRESHOLD) return false;
+
+    // Only one thread gets to do the compiling.
+    JitState expected = JIT_COLD;
+    if (!atomic_compare_exchange_strong(&defun->jit_state, &expected, JIT_COMPILING)) {
+        return false;
+    }
+
+    bool compiled = jit_compile_defun(defun);
+    atomic_store_explicit(
+        &defun->jit_state,
+        compiled ? JIT_COMPILED : JIT_FAILED,
+        memory_order_release
+    );
+    return compiled;
+}
+
+
+
+/*
+ * Budgets.
+ *
+ * Limits how much work a run can do. Fuel is spent at one per function, but is
+ * charged a whole function array at a time when the interpreter enters it, so
+ * the dispatch loop itself doesn't have to count. The wall-clock deadline is
+ * checked on every charge, and natives that go through a lot of elements check
+ * it as they go, so a single big native can't run far past it either.
+ */
+
+/**
+ * Gets the time deadlines are measured in, in nanoseconds. The coarse clock is
+ * used where there is one, since it's much cheaper to read, and a few
+ * milliseconds off is close enough for a timeout.
+ */
+static int64_t budget_clock(void) {
+    struct timespec now;
+#ifdef CLOCK_MONOTONIC_COARSE
+    (void)clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+#else  // CLOCK_MONOTONIC_COARSE
+    (void)clock_gettime(CLOCK_MONOTONIC, &now);
+#endif // CLOCK_MONOTONIC_COARSE
+    return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/**
+ * Refills the fuel and sets the deadline for a new run.
+ */
+static void budget_start(void) {
+    Budget* budget = &interpreter->budget;
+
+    atomic_store(&budget->fuel, budget->fuel_limit);
+    if (budget->time_limited) {
+        budget->deadline = budget_clock() + (int64_t)(budget->time_limit * 1e9);
+    }
+}
+
+/**
+ * Returns true if the run has a deadline and it has passed.
+ */
+static bool budget_expired(void) {
+    Budget* budget = &interpreter->budget;
+    return budget->time_limited && budget_clock() >= budget->deadline;
+}
+
+/**
+ * Spends fuel for a block of cost functions and checks the deadline.
+ */
+static Error budget_charge(size_t cost) {
+    Budget* budget = &interpreter->budget;
+
+    if (budget->fuel_limited) {
+        int64_t fuel = atomic_fetch_sub_explicit(&budget->fuel, (int64_t)cost, memory_order_relaxed);
+        if (fuel < (int64_t)cost) return ERROR_OUT_OF_FUEL;
+    }
+
+    return budget_expired() ? ERROR_TIMED_OUT : ERROR_OK;
+}
+
+// Elements gone through by natives on this thread since the deadline was last
+// checked.
+static _Thread_local size_t budget_ticks = 0;
+
+/**
+ * Called by natives as they go through work elements, checking the deadline
+ * every BUDGET_CLOCK_INTERVAL of them.
+ */
+static Error budget_tick(size_t work) {
+    budget_ticks += work;
+    if (budget_ticks < BUDGET_CLOCK_INTERVAL) return ERROR_OK;
+
+    budget_ticks = 0;
+    return budget_expired() ? ERROR_TIMED_OUT : ERROR_OK;
+}
+
+
+
+typedef struct {
+    FunctionArray* functions;
+    // Index of the next function to execute.
+    size_t         index;
+    // Cache entry waiting on the results of the frame's defun if it's being
+    // memoized.
+    MemoEntry*     memo_entry;
+} CallFrame;
+
+typedef ARRAY_OF(CallFrame) CallFrameArray;
+
+static Error execute_operator(Function* function, ValueArray* stack);
+static Error execute_fork(Function* function, ValueArray* stack);
+static bool  defun_memoizable(Defun* defun);
+static bool  memo_lookup(Defun *restrict defun, ValueArray *restrict stack, MemoEntry* *restrict pending, Error *restrict result);
+static Error memo_insert(MemoEntry *restrict entry, ValueArray *restrict stack);
+static void  memo_entry_free(MemoEntry* entry);
+
+/**
+ * Executes the functions on the stack.
+ *
+ * Defun calls are tracked on an explicit call stack instead of recursing in C,
+ * so however deeply defuns are nested, they only cost heap memory. Defuns are
+ * anonymous and never share bodies, so programs can't recurse, and the depth is
+ * bounded by the nesting in the source. A caller with nothing left to run is
+ * dropped before entering the callee, so it doesn't take up a frame.
+ */
+static Error execute_functions(FunctionArray* functions, ValueArray* stack) {
+    Error result = budget_charge(functions->count);
+    if (ERROR_OK != result) return result;
+
+    CallFrameArray call_stack = {0};
+    CallFrame      frame      = { .functions = functions, .index = 0, .memo_entry = NULL };
+
+    for (;;) {
+        if (frame.index >= frame.functions->count) {
+            if (NULL != frame.memo_entry) {
+                result = memo_insert(frame.memo_entry, stack);
+                frame.memo_entry = NULL;
+                if (ERROR_OK != result) break;
+            }
+
+            if (0 == call_stack.count) break;
+            frame = call_stack.elements[--call_stack.count];
+            continue;
+        }
+
+        Function* function = &frame.functions->elements[frame.index++];
+
+        switch (function->type) {
+        case FUNCTION_DEFUN: {
+            Defun*     defun      = &function->as_defun;
+            MemoEntry* memo_entry = NULL;
+
+            result = budget_charge(defun->functions.count);
+            if (ERROR_OK != result) break;
+
+            if (interpreter->memoize_enabled && defun_memoizable(defun)) {
+                if (memo_lookup(defun, stack, &memo_entry, &result)) break;
+            }
+
+            if (jit_ready(defun)) {
+                result = defun->jit_code.entry(stack);
+                if (NULL == memo_entry)  break;
+                if (ERROR_OK == result) result = memo_insert(memo_entry, stack);
+                else                    memo_entry_free(memo_entry);
+                break;
+            }
+
+            // Frames waiting to memoize their results can't be dropped for tail
+            // calls.
+            if (frame.index < frame.functions->count || NULL != frame.memo_entry) {
+                ARRAY_APPEND(&call_stack, &interpreter->allocator, frame);
+            }
+            frame.functions  = &defun->functions;
+            frame.index      = 0;
+            frame.memo_entry = memo_entry;
+        } break;
+        case FUNCTION_NATIVE: {
+            result = native_call(function, stack);
+        } break;
+        case FUNCTION_LITERAL: {
+            ARRAY_APPEND(
+                stack,
+                &interpreter->allocator,
+                value_deep_copy(&function->as_literal)
+            );
+        } break;
+        case FUNCTION_EACH:
+        case FUNCTION_RANK: {
+            result = execute_operator(function, stack);
+        } break;
+        case FUNCTION_FORK: {
+            result = execute_fork(function, stack);
+        } break;
+        default: assert(0 && "Unreachable");
+        };
+
+        if (ERROR_OK != result) break;
+    }
+
+    if (ERROR_OK != result) {
+        if (NULL != frame.memo_entry) memo_entry_free(frame.memo_entry);
+        for (size_t i = 0; i < call_stack.count; ++i) {
+            if (NULL != call_stack.elements[i].memo_entry) {
+                memo_entry_free(call_stack.elements[i].memo_entry);
+            }
+        }
+    }
+
+    ARRAY_FREE(&call_stack, &interpreter->allocator);
+    return result;
+}
+
+
+
+/*
+ * Operators.
+ */
+
+/**
+ * Returns true if the native only works with the stack and has no outside
+ * effects.
+ */
+static bool native_is_pure(Error(*native)(ValueArray*)) {
+    return native != &native_o && native != &native_kute && native != &native_kulupu;
+}
+
+/**
+ * Returns true if running the functions has no effects outside of the stack,
+ * meaning they can safely be run in parallel.
+ */
+static bool functions_are_pure(const FunctionArray* functions) {
+    for (size_t i = 0; i < functions->count; ++i) {
+        const Function* function = &functions->elements[i];
+
+        switch (function->type) {
+        case FUNCTION_NATIVE: {
+            if (!native_is_pure(function->as_native)) return false;
+        } break;
+        case FUNCTION_DEFUN: {
+            if (!functions_are_pure(&function->as_defun.functions)) return false;
+        } break;
+        case FUNCTION_EACH:
+        case FUNCTION_RANK:
+        case FUNCTION_FORK: {
+            if (!functions_are_pure(&function->as_operator.functions)) return false;
+        } break;
+        case FUNCTION_LITERAL: break;
+        default: assert(0 && "Unreachable");
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Returns how deeply nested the value is. Scalars have a depth of 0, and arrays
+ * have a depth of one more than their deepest element.
+ */
+static size_t value_depth(const Value* value) {
+    if (VALUE_ARRAY != value->type) return 0;
+
+    size_t max_depth = 0;
+    for (size_t i = 0; i < value->as_array.count; ++i) {
+        size_t depth = value_depth(&value->as_array.elements[i]);
+        if (depth > max_depth) max_depth = depth;
+    }
+
+    return max_depth + 1;
+}
+
+/**
+ * Applies the operator to the cell in place, using scratch as the stack to run
+ * the functions on. The functions must leave exactly one value behind, else
+ * shape error. On error the cell is replaced with 0.
+ */
+static Error apply_operator_cell( Function *restrict function
+                                , Value *restrict cell
+                                , ValueArray *restrict scratch) {
+    Operator* operator = &function->as_operator;
+
+    if ( FUNCTION_RANK == function->type && VALUE_ARRAY == cell->type
+      && value_depth(cell) > operator->rank) {
+        for (size_t i = 0; i < cell->as_array.count; ++i) {
+            Error result = apply_operator_cell(function, &cell->as_array.elements[i], scratch);
+            if (ERROR_OK != result) return result;
+        }
+        return ERROR_OK;
+    }
+
+    scratch->count = 0;
+    ARRAY_APPEND(scratch, &interpreter->allocator, *cell);
+
+    Error result = execute_functions(&operator->functions, scratch);
+    if (ERROR_OK == result && 1 != scratch->count) result = ERROR_SHAPE;
+    // Lazy values can't go inside arrays.
+    if (ERROR_OK == result) result = value_force_budgeted(&scratch->elements[0]);
+
+    if (ERROR_OK == result) {
+        *cell = scratch->elements[0];
+    } else {
+        for (size_t i = 0; i < scratch->count; ++i) {
+            value_free(&scratch->elements[i]);
+        }
+        cell->type      = VALUE_NUMBER;
+        cell->as_number = 0;
+    }
+    scratch->count = 0;
+
+    return result;
+}
+
+typedef struct {
+    Function*   function;
+    ValueArray* cells;
+    _Atomic int result;
+} OperatorTask;
+
+static void operator_task_body(void* context, size_t start, size_t end) {
+    OperatorTask* task    = context;
+    ValueArray    scratch = {0};
+
+    for (size_t i = start; i < end; ++i) {
+        if (ERROR_OK != atomic_load_explicit(&task->result, memory_order_relaxed)) break;
+
+        Error result = apply_operator_cell(task->function, &task->cells->elements[i], &scratch);
+        if (ERROR_OK != result) {
+            int expected = ERROR_OK;
+            (void)atomic_compare_exchange_strong(&task->result, &expected, (int)result);
+        }
+    }
+
+    ARRAY_FREE(&scratch, &interpreter->allocator);
+}
+
+/**
+ * Each - monadic operator, written ( functions ) wan.
+ *
+ * On array - replaces every element of the array with the result of applying
+ * the functions to it.
+ * On number or character - applies the functions to the value.
+ *
+ * Rank - monadic operator, written ( functions ) rank nena.
+ *
+ * On array - if the array is nested no more than rank levels deep, applies the
+ * functions to the array, else recursively applies rank to the elements of the
+ * array.
+ * On number or character - applies the functions to the value.
+ *
+ * The result is written into the input array, so no new array is allocated.
+ * Large arrays are processed on multiple threads if the functions are pure.
+ * Shape error if the functions don't leave exactly one value.
+ */
+static Error execute_operator(Function* function, ValueArray* stack) {
+    if (stack->count < 1) return ERROR_STACK_UNDERFLOW;
+    Error result = stack_force_budgeted(stack, 1);
+    if (ERROR_OK != result) return result;
+
+    Value* a           = &stack->elements[stack->count - 1];
+    bool   on_elements = VALUE_ARRAY == a->type
+                      && ( FUNCTION_EACH == function->type
+                        || value_depth(a) > function->as_operator.rank );
+
+    OperatorTask task = {
+        .function = function,
+        .cells    = NULL,
+        .result   = ERROR_OK
+    };
+
+    if (!on_elements) {
+        ValueArray scratch = {0};
+        task.result = apply_operator_cell(function, a, &scratch);
+        ARRAY_FREE(&scratch, &interpreter->allocator);
+    } else {
+        task.cells = &a->as_array;
+
+        if ( a->as_array.count >= PARALLEL_THRESHOLD
+          && functions_are_pure(&function->as_operator.functions)) {
+            // Cells that get skipped are left as they are, but a will be freed
+            // for the error anyways.
+            result = parallel_for_budgeted(a->as_array.count, PARALLEL_CHUNK_SIZE, &operator_task_body, &task);
+            if (ERROR_OK != result) {
+                int expected = ERROR_OK;
+                (void)atomic_compare_exchange_strong(&task.result, &expected, (int)result);
+            }
+        } else {
+            operator_task_body(&task, 0, a->as_array.count);
+        }
+    }
+
+    result = (Error)task.result;
+    if (ERROR_OK != result) {
+        value_free(a);
+        --stack->count;
+    }
+
+    return result;
+}
+
+
+
+/*
+ * Stack effects.
+ */
+
+/**
+ * Gets how many values the native takes off of the stack and how many it puts
+ * back. Returns false if the native doesn't have a fixed stack effect.
+ */
+static bool native_stack_effect( Error(*native)(ValueArray*)
+                               , size_t *restrict inputs
+                               , size_t *restrict outputs) {
+    if ( native == &native_pona || native == &native_ike || native == &native_mute
+      || native == &native_kipisi || native == &native_olin) {
+        *inputs = 2; *outputs = 1;
+    } else if (native == &native_nanpa || native == &native_ale || native == &native_nasin) {
+        *inputs = 1; *outputs = 1;
+    } else if (native == &native_o) {
+        *inputs = 1; *outputs = 0;
+    } else if (native == &native_kute) {
+        *inputs = 1; *outputs = 2;
+    } else if (native == &native_kulupu) {
+        *inputs = 2; *outputs = 2;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+static bool functions_stack_effect( const FunctionArray *restrict functions
+                                  , size_t *restrict inputs
+                                  , size_t *restrict outputs);
+
+/**
+ * Gets the stack effect of a single function. Returns false if it can't be
+ * worked out.
+ */
+static bool function_stack_effect( const Function *restrict function
+                                 , size_t *restrict inputs
+                                 , size_t *restrict outputs) {
+    switch (function->type) {
+    case FUNCTION_NATIVE: {
+        return native_stack_effect(function->as_native, inputs, outputs);
+    } break;
+    case FUNCTION_DEFUN: {
+        return functions_stack_effect(&function->as_defun.functions, inputs, outputs);
+    } break;
+    case FUNCTION_LITERAL: {
+        *inputs  = 0;
+        *outputs = 1;
+    } break;
+    case FUNCTION_EACH:
+    case FUNCTION_RANK: {
+        *inputs  = 1;
+        *outputs = 1;
+    } break;
+    case FUNCTION_FORK: {
+        // Only the first branch takes values off of the stack, and all of the
+        // results end up on it.
+        const FunctionArray* branches = &function->as_operator.functions;
+        *outputs = 0;
+        for (size_t i = 0; i < branches->count; ++i) {
+            size_t branch_inputs;
+            size_t branch_outputs;
+            if (!function_stack_effect(&branches->elements[i], &branch_inputs, &branch_outputs)) {
+                return false;
+            }
+            if (0 == i) *inputs = branch_inputs;
+            *outputs += branch_outputs;
+        }
+    } break;
+    default: assert(0 && "Unreachable");
+    }
+
+    return true;
+}
+
+/**
+ * Gets how many values from the stack running the functions will consume, and
+ * how many values will be left in their place. Returns false if it can't be
+ * worked out.
+ */
+static bool functions_stack_effect( const FunctionArray *restrict functions
+                                  , size_t *restrict inputs
+                                  , size_t *restrict outputs) {
+    // needed is how far below the starting stack the functions reach, height is
+    // how many values are on the stack above that.
+    size_t needed = 0;
+    size_t height = 0;
+
+    for (size_t i = 0; i < functions->count; ++i) {
+        size_t function_inputs;
+        size_t function_outputs;
+        if (!function_stack_effect(&functions->elements[i], &function_inputs, &function_outputs)) {
+            return false;
+        }
+
+        if (function_inputs > height) {
+            needed += function_inputs - height;
+            height  = function_inputs;
+        }
+        height = height - function_inputs + function_outputs;
+    }
+
+    *inputs  = needed;
+    *outputs = height;
+    return true;
+}
+
+
+
+
+/*
+ * Dataflow parallelism.
+ *
+ * Following which values each function takes off of the stack splits a
+ * sequence of pure functions into regions, where a region never touches the
+ * values left by the regions before it. Consecutive regions are therefore
+ * independent and can run at the same time: the first on the stack itself,
+ * since it may take values from it, and the rest on stacks of their own whose
+ * results are appended in order once all of them are done. The function that
+ * finally combines their results joins them.
+ */
+
+typedef struct {
+    size_t    begin;
+    size_t    end;
+    // Stack height after the region, relative to the start of the span.
+    ptrdiff_t height;
+} Region;
+
+typedef ARRAY_OF(Region) RegionArray;
+
+/**
+ * Splits the span of functions into it's outermost independent regions. All of
+ * the functions must have a known stack effect.
+ */
+static void find_regions( const FunctionArray *restrict functions
+                        , size_t begin
+                        , size_t end
+                        , RegionArray *restrict regions) {
+    regions->count = 0;
+    ptrdiff_t height = 0;
+
+    for (size_t i = begin; i < end; ++i) {
+        size_t inputs;
+        size_t outputs;
+        bool   known = function_stack_effect(&functions->elements[i], &inputs, &outputs);
+        assert(known && "Regions need known stack effects");
+        (void)known;
+
+        // Regions the function takes values from are merged into one with it.
+        ptrdiff_t reach        = height - (ptrdiff_t)inputs;
+        size_t    region_begin = i;
+        while (0 != regions->count && regions->elements[regions->count - 1].height > reach) {
+            region_begin = regions->elements[--regions->count].begin;
+        }
+
+        height = reach + (ptrdiff_t)outputs;
+        Region region = {
+            .begin  = region_begin,
+            .end    = i + 1,
+            .height = height
+        };
+        ARRAY_APPEND(regions, &interpreter->allocator, region);
+    }
+}
+
+/**
+ * Returns true if the span of functions calls something that might be worth
+ * running on another thread.
+ */
+static bool span_is_heavy(const FunctionArray* functions, size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+        switch (functions->elements[i].type) {
+        case FUNCTION_DEFUN:
+        case FUNCTION_EACH:
+        case FUNCTION_RANK:
+        case FUNCTION_FORK:    return true;
+        case FUNCTION_NATIVE:
+        case FUNCTION_LITERAL: break;
+        default: assert(0 && "Unreachable");
+        }
+    }
+    return false;
+}
+
+/**
+ * Moves the span of functions into output, turning independent regions into
+ * forks.
+ */
+static void parallelize_span( FunctionArray *restrict functions
+                            , size_t begin
+                            , size_t end
+                            , FunctionArray *restrict output) {
+    if (end - begin < 2) {
+        for (size_t i = begin; i < end; ++i) {
+            ARRAY_APPEND(output, &interpreter->allocator, functions->elements[i]);
+        }
+        return;
+    }
+
+    // Functions with effects or unknown stack effects keep everything around
+    // them in order.
+    for (size_t i = begin; i < end; ++i) {
+        const Function* function = &functions->elements[i];
+        FunctionArray   single   = { .elements = &functions->elements[i], .count = 1, .capacity = 1 };
+        size_t inputs;
+        size_t outputs;
+
+        if ( !function_stack_effect(function, &inputs, &outputs)
+          || !functions_are_pure(&single)) {
+            parallelize_span(functions, begin, i, output);
+            ARRAY_APPEND(output, &interpreter->allocator, functions->elements[i]);
+            parallelize_span(functions, i + 1, end, output);
+            return;
+        }
+    }
+
+    RegionArray regions = {0};
+    find_regions(functions, begin, end, &regions);
+
+    // One region means the last function joins everything before it.
+    if (1 == regions.count) {
+        ARRAY_FREE(&regions, &interpreter->allocator);
+        parallelize_span(functions, begin, end - 1, output);
+        ARRAY_APPEND(output, &interpreter->allocator, functions->elements[end - 1]);
+        return;
+    }
+
+    size_t heavy = 0;
+    for (size_t i = 0; i < regions.count; ++i) {
+        if (span_is_heavy(functions, regions.elements[i].begin, regions.elements[i].end)) ++heavy;
+    }
+
+    if (heavy < 2) {
+        for (size_t i = 0; i < regions.count; ++i) {
+            parallelize_span(functions, regions.elements[i].begin, regions.elements[i].end, output);
+        }
+        ARRAY_FREE(&regions, &interpreter->allocator);
+        return;
+    }
+
+    // Every branch gets one heavy region. Light regions go along with the
+    // heavy region after them, or the last one if there isn't any.
+    Function fork = {
+        .type        = FUNCTION_FORK,
+        .as_operator = { .functions = {0}, .rank = 0 }
+    };
+    size_t branch_begin = begin;
+    size_t heavy_seen   = 0;
+    for (size_t i = 0; i < regions.count; ++i) {
+        const Region* region   = &regions.elements[i];
+        bool          is_heavy = span_is_heavy(functions, region->begin, region->end);
+        if (is_heavy) ++heavy_seen;
+
+        bool branch_ends = i + 1 == regions.count || (is_heavy && heavy_seen < heavy);
+        if (!branch_ends) continue;
+
+        Function branch = {
+            .type     = FUNCTION_DEFUN,
+            .as_defun = { .functions = {0} }
+        };
+        parallelize_span(functions, branch_begin, region->end, &branch.as_defun.functions);
+        ARRAY_APPEND(&fork.as_operator.functions, &interpreter->allocator, branch);
+        branch_begin = region->end;
+    }
+    ARRAY_FREE(&regions, &interpreter->allocator);
+
+    ARRAY_APPEND(output, &interpreter->allocator, fork);
+}
+
+/**
+ * Parallelizes the functions and everything inside of them.
+ */
+static void parallelize_regions_within(FunctionArray* functions) {
+    for (size_t i = 0; i < functions->count; ++i) {
+        Function* function = &functions->elements[i];
+
+        switch (function->type) {
+        case FUNCTION_DEFUN: {
+            parallelize_regions_within(&function->as_defun.functions);
+        } break;
+        case FUNCTION_EACH:
+        case FUNCTION_RANK: {
+            parallelize_regions_within(&function->as_operator.functions);
+        } break;
+        case FUNCTION_NATIVE:
+        case FUNCTION_LITERAL:
+        case FUNCTION_FORK: break;
+        default: assert(0 && "Unreachable");
+        }
+    }
+
+    FunctionArray parallelized = {0};
+    parallelize_span(functions, 0, functions->count, &parallelized);
+
+    if (parallelized.count == functions->count) {
+        // Nothing changed.
+        ARRAY_FREE(&parallelized, &interpreter->allocator);
+    } else {
+        ARRAY_SWAP(functions, &parallelized);
+        ARRAY_FREE(&parallelized, &interpreter->allocator);
+    }
+}
+
+/**
+ * Dataflow parallelization pass.
+ *
+ * Replaces independent regions of pure code that call defuns or operators with
+ * forks. Does nothing if there's only one thread to run them on.
+ */
+static void parallelize_regions(FunctionArray* functions) {
+    if (thread_pool_size() < 2) return;
+    parallelize_regions_within(functions);
+}
+
+typedef struct {
+    FunctionArray* branches;
+    ValueArray*    stack;
+    // Stacks of the other branches, the first one is unused.
+    ValueArray*    stacks;
+    Error*         results;
+} ForkTask;
+
+static void fork_task_body(void* context, size_t start, size_t end) {
+    ForkTask* task = context;
+
+    for (size_t i = start; i < end; ++i) {
+        // Called like a normal defun so it can be memoized and JIT compiled.
+        FunctionArray call = {
+            .elements = &task->branches->elements[i],
+            .count    = 1,
+            .capacity = 1
+        };
+        task->results[i] = execute_functions(&call, 0 == i ? task->stack : &task->stacks[i]);
+    }
+}
+
+/**
+ * Runs the branches of the fork at the same time, the first one on the stack
+ * and the others on their own stacks. The values left by the others are then
+ * put on the stack in order, unless one of the branches fails.
+ */
+static Error execute_fork(Function* function, ValueArray* stack) {
+    FunctionArray* branches = &function->as_operator.functions;
+    size_t         count    = branches->count;
+
+    ValueArray* stacks  = interpreter_allocate(count * sizeof(ValueArray), "fork stacks");
+    Error*      results = interpreter_allocate(count * sizeof(Error), "fork stacks");
+    (void)memset(stacks,  0, count * sizeof(ValueArray));
+    (void)memset(results, 0, count * sizeof(Error));
+
+    ForkTask task = {
+        .branches = branches,
+        .stack    = stack,
+        .stacks   = stacks,
+        .results  = results
+    };
+    parallel_for(count, 1, &fork_task_body, &task);
+
+    Error result = ERROR_OK;
+    for (size_t i = 0; i < count && ERROR_OK == result; ++i) result = results[i];
+
+    for (size_t i = 1; i < count; ++i) {
+        for (size_t k = 0; k < stacks[i].count; ++k) {
+            if (ERROR_OK == result) ARRAY_APPEND(stack, &interpreter->allocator, stacks[i].elements[k]);
+            else                    value_free(&stacks[i].elements[k]);
+        }
+        ARRAY_FREE(&stacks[i], &interpreter->allocator);
+    }
+
+    interpreter_free(stacks);
+    interpreter_free(results);
+    return result;
+}
+
+
+
+/*
+ * Memoization.
+ *
+ * Results of pure defuns are cached in a bounded LRU cache, keyed by the defun's
+ * body and the values it takes from the stack. The values are compared
+ * structurally, so any array with the same contents is a hit.
+ */
+
+struct MemoEntry {
+    // The body of the defun, which is shared by copies of the same defun.
+    const Function* body;
+    size_t          output_count;
+    uint64_t        hash;
+    ValueArray      inputs;
+    ValueArray      outputs;
+    MemoEntry*      bucket_next;
+    MemoEntry*      lru_previous;
+    MemoEntry*      lru_next;
+};
+
+#define FNV_OFFSET_BASIS 14695981039346656037ULL
+#define FNV_PRIME        1099511628211ULL
+
+static uint64_t hash_bytes(uint64_t hash, const void* bytes, size_t size) {
+    const uint8_t* data = bytes;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= data[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+/**
+ * Hashes the structure and contents of the value with FNV-1a.
+ */
+static uint64_t value_hash(uint64_t hash, const Value* value) {
+    uint8_t type = (uint8_t)value->type;
+    hash = hash_bytes(hash, &type, sizeof(type));
+
+    switch (value->type) {
+    case VALUE_NUMBER: {
+        hash = hash_bytes(hash, &value->as_number, sizeof(value->as_number));
+    } break;
+    case VALUE_CHARACTER: {
+        hash = hash_bytes(hash, &value->as_character, sizeof(value->as_character));
+    } break;
+    case VALUE_ARRAY: {
+        hash = hash_bytes(hash, &value->as_array.count, sizeof(value->as_array.count));
+        for (size_t i = 0; i < value->as_array.count; ++i) {
+            hash = value_hash(hash, &value->as_array.elements[i]);
+        }
+    } break;
+    case VALUE_LAZY:
+    default: assert(0 && "Unreachable");
+    }
+
+    return hash;
+}
+
+/**
+ * Returns true if the values have the same structure and contents. Numbers are
+ * compared bit-for-bit to match value_hash.
+ */
+static bool values_equal(const Value* a, const Value* b) {
+    if (a->type != b->type) return false;
+
+    switch (a->type) {
+    case VALUE_NUMBER: {
+        return 0 == memcmp(&a->as_number, &b->as_number, sizeof(a->as_number));
+    }
+    case VALUE_CHARACTER: return a->as_character == b->as_character;
+    case VALUE_ARRAY: {
+        if (a->as_array.count != b->as_array.count) return false;
+        for (size_t i = 0; i < a->as_array.count; ++i) {
+            if (!values_equal(&a->as_array.elements[i], &b->as_array.elements[i])) {
+                return false;
+            }
+        }
+        return true;
+    }
+    case VALUE_LAZY:
+    default: assert(0 && "Unreachable");
+    }
+}
+
+/**
+ * Returns true if the defun can be memoized, working it out on the first call.
+ */
+static bool defun_memoizable(Defun* defun) {
+    MemoState state = atomic_load_explicit(&defun->memo_state, memory_order_acquire);
+    if (MEMO_UNKNOWN != state) return MEMO_MEMOIZABLE == state;
+
+    // Only one thread gets to do the analysis, the others just run the defun
+    // normally in the meantime.
+    MemoState expected = MEMO_UNKNOWN;
+    if (!atomic_compare_exchange_strong(&defun->memo_state, &expected, MEMO_ANALYZING)) {
+        return false;
+    }
+
+    size_t inputs;
+    size_t outputs;
+    bool   memoizable = functions_are_pure(&defun->functions)
+                     && functions_stack_effect(&defun->functions, &inputs, &outputs);
+
+    if (memoizable) {
+        defun->memo_inputs  = inputs;
+        defun->memo_outputs = outputs;
+    }
+    atomic_store_explicit(
+        &defun->memo_state,
+        memoizable ? MEMO_MEMOIZABLE : MEMO_UNMEMOIZABLE,
+        memory_order_release
+    );
+
+    return memoizable;
+}
+
+static void memo_entry_free(MemoEntry* entry) {
+    for (size_t i = 0; i < entry->inputs.count; ++i) {
+        value_free(&entry->inputs.elements[i]);
+    }
+    ARRAY_FREE(&entry->inputs, &interpreter->allocator);
+    for (size_t i = 0; i < entry->outputs.count; ++i) {
+        value_free(&entry->outputs.elements[i]);
+    }
+    ARRAY_FREE(&entry->outputs, &interpreter->allocator);
+    interpreter_free(entry);
+}
+
+static void memo_lru_unlink(MemoEntry* entry) {
+    MemoCache* cache = &interpreter->memo_cache;
+    if (NULL != entry->lru_previous) entry->lru_previous->lru_next = entry->lru_next;
+    else                             cache->lru_head               = entry->lru_next;
+    if (NULL != entry->lru_next)     entry->lru_next->lru_previous = entry->lru_previous;
+    else                             cache->lru_tail               = entry->lru_previous;
+}
+
+static void memo_lru_push_front(MemoEntry* entry) {
+    MemoCache* cache = &interpreter->memo_cache;
+    entry->lru_previous = NULL;
+    entry->lru_next     = cache->lru_head;
+    if (NULL != cache->lru_head) cache->lru_head->lru_previous = entry;
+    else                         cache->lru_tail               = entry;
+    cache->lru_head = entry;
+}
+
+/**
+ * Looks for a cached result of calling the defun on the top of the stack. On a
+ * hit, the inputs on the stack are replaced with the cached outputs and true is
+ * returned. On a miss, pending is set to an entry holding a copy of the inputs
+ * for memo_insert to fill in once the defun returns, or NULL if there aren't
+ * enough values on the stack. If the deadline passes while forcing the inputs,
+ * true is returned with ERROR_TIMED_OUT in result, else result is ERROR_OK.
+ */
+static bool memo_lookup( Defun *restrict defun
+                       , ValueArray *restrict stack
+                       , MemoEntry* *restrict pending
+                       , Error *restrict result) {
+    *pending = NULL;
+    *result  = ERROR_OK;
+    if (stack->count < defun->memo_inputs) return false;
+    *result = stack_force_budgeted(stack, defun->memo_inputs);
+    if (ERROR_OK != *result) return true;
+
+    const Value* inputs  = &stack->elements[stack->count - defun->memo_inputs];
+    uintptr_t    address = (uintptr_t)defun->functions.elements;
+    uint64_t     hash    = hash_bytes(FNV_OFFSET_BASIS, &address, sizeof(address));
+    for (size_t i = 0; i < defun->memo_inputs; ++i) {
+        hash = value_hash(hash, &inputs[i]);
+    }
+
+    (void)pthread_mutex_lock(&interpreter->memo_cache.lock);
+
+    MemoEntry* entry = NULL;
+    if (NULL != interpreter->memo_cache.buckets) {
+        entry = interpreter->memo_cache.buckets[hash % MEMO_CAPACITY];
+        for (; NULL != entry; entry = entry->bucket_next) {
+            if (entry->body != defun->functions.elements || entry->hash != hash) continue;
+
+            bool equal = true;
+            for (size_t i = 0; i < defun->memo_inputs; ++i) {
+                if (!values_equal(&entry->inputs.elements[i], &inputs[i])) {
+                    equal = false;
+                    break;
+                }
+            }
+            if (equal) break;
+        }
+    }
+
+    if (NULL != entry) {
+        ++interpreter->memo_cache.hits;
+        memo_lru_unlink(entry);
+        memo_lru_push_front(entry);
+
+        for (size_t i = stack->count - defun->memo_inputs; i < stack->count; ++i) {
+            value_free(&stack->elements[i]);
+        }
+        stack->count -= defun->memo_inputs;
+        for (size_t i = 0; i < entry->outputs.count; ++i) {
+            ARRAY_APPEND(
+                stack,
+                &interpreter->allocator,
+                value_deep_copy(&entry->outputs.elements[i])
+            );
+        }
+
+        (void)pthread_mutex_unlock(&interpreter->memo_cache.lock);
+        return true;
+    }
+
+    ++interpreter->memo_cache.misses;
+    (void)pthread_mutex_unlock(&interpreter->memo_cache.lock);
+
+    MemoEntry* new_entry = interpreter_allocate(sizeof(MemoEntry), "memoization entry");
+    (void)memset(new_entry, 0, sizeof(MemoEntry));
+    new_entry->body         = defun->functions.elements;
+    new_entry->output_count = defun->memo_outputs;
+    new_entry->hash         = hash;
+    ARRAY_RESIZE(&new_entry->inputs, &interpreter->allocator, defun->memo_inputs);
+    for (size_t i = 0; i < defun->memo_inputs; ++i) {
+        new_entry->inputs.elements[i] = value_deep_copy(&inputs[i]);
+    }
+    new_entry->inputs.count = defun->memo_inputs;
+
+    *pending = new_entry;
+    return false;
+}
+
+/**
+ * Fills in the pending entry from memo_lookup with the outputs of the defun on
+ * the top of the stack and adds it to the cache, evicting the least recently
+ * used entry if full. If the deadline passes while forcing the outputs, the
+ * entry is freed instead and ERROR_TIMED_OUT is returned.
+ */
+static Error memo_insert(MemoEntry *restrict entry, ValueArray *restrict stack) {
+    size_t outputs = entry->output_count;
+    assert(stack->count >= outputs);
+    Error result = stack_force_budgeted(stack, outputs);
+    if (ERROR_OK != result) {
+        memo_entry_free(entry);
+        return result;
+    }
+
+    ARRAY_RESIZE(&entry->outputs, &interpreter->allocator, outputs);
+    for (size_t i = 0; i < outputs; ++i) {
+        entry->outputs.elements[i] = value_deep_copy(
+            &stack->elements[stack->count - outputs + i]
+        );
+    }
+    entry->outputs.count = outputs;
+
+    (void)pthread_mutex_lock(&interpreter->memo_cache.lock);
+
+    if (NULL == interpreter->memo_cache.buckets) {
+        interpreter->memo_cache.buckets = interpreter_allocate(
+            MEMO_CAPACITY * sizeof(MemoEntry*),
+            "memoization cache"
+        );
+        (void)memset(interpreter->memo_cache.buckets, 0, MEMO_CAPACITY * sizeof(MemoEntry*));
+    }
+
+    if (interpreter->memo_cache.count >= MEMO_CAPACITY) {
+        MemoEntry*  evicted = interpreter->memo_cache.lru_tail;
+        MemoEntry** link    = &interpreter->memo_cache.buckets[evicted->hash % MEMO_CAPACITY];
+        while (*link != evicted) link = &(*link)->bucket_next;
+        *link = evicted->bucket_next;
+
+        memo_lru_unlink(evicted);
+        memo_entry_free(evicted);
+        --interpreter->memo_cache.count;
+    }
+
+    MemoEntry** bucket  = &interpreter->memo_cache.buckets[entry->hash % MEMO_CAPACITY];
+    entry->bucket_next = *bucket;
+    *bucket            = entry;
+    memo_lru_push_front(entry);
+    ++interpreter->memo_cache.count;
+
+    (void)pthread_mutex_unlock(&interpreter->memo_cache.lock);
+    return ERROR_OK;
+}
+
+static void memo_cache_free(void) {
+    while (NULL != interpreter->memo_cache.lru_head) {
+        MemoEntry* entry = interpreter->memo_cache.lru_head;
+        interpreter->memo_cache.lru_head = entry->lru_next;
+        memo_entry_free(entry);
+    }
+    interpreter_free(interpreter->memo_cache.buckets);
+    interpreter->memo_cache.buckets  = NULL;
+    interpreter->memo_cache.lru_tail = NULL;
+    interpreter->memo_cache.count    = 0;
+}
+
+
+
+#define ARRAY_SIZE(array) sizeof(array)/sizeof(array[0])
+
+#ifndef TLPIN_LIBRARY
+/**
+ * Prints out the stack to the file, forcing any lazy values on it.
+ */
+static void dump_stack(FILE *restrict file, ValueArray *restrict stack) {
+    for (size_t i = 0; i < stack->count; ++i) {
+        Value* value = &stack->elements[i];
+        value_force(value);
+
+        switch (value->type) {
+        case VALUE_NUMBER:    (void)fprintf(file, "%lf ", value->as_number);    break;
+        case VALUE_CHARACTER: (void)fprintf(file, "%c ",  value->as_character); break;
+
+        case VALUE_ARRAY: {
+            (void)fputs("{ ", file);
+            dump_stack(file, &value->as_array);
+            (void)fputs("} ", file);
+        } break;
+
+        case VALUE_LAZY:
+        default: assert(0 && "Unreachable");
+        };
+    }
+}
+
+static const char* error_message(Error error) {
+    switch (error) {
+    case ERROR_DOMAIN:          return "DOMAIN ERROR";
+    case ERROR_SHAPE:           return "SHAPE ERROR";
+    case ERROR_STACK_UNDERFLOW: return "STACK UNDERFLOW";
+    case ERROR_OUT_OF_FUEL:     return "OUT OF FUEL";
+    case ERROR_TIMED_OUT:       return "TIMED OUT";
+    case ERROR_OK:
+    case ERROR_GUARD:
+    default:                    assert(0 && "Unreachable");
+    }
+}
+#endif // TLPIN_LIBRARY
+
+
+
+/*
+ * Lexing.
+ *
+ * The lexer is pulled from one lexeme at a time by the compiler, so nothing but
+ * the lexeme being compiled is kept around, however big the source is.
+ * Lexemes don't own any memory, they just point out where their text is in the
+ * source, so the source must outlive them.
+ *
+ * Lines and columns aren't tracked while lexing, since they're only needed for
+ * error messages. source_position works them out from the offset instead.
+ *
+ * Rather than looking at one character at a time, the lexer classifies the
+ * source a block at a time into bitmasks, with SSE2 where there is it, and
+ * jumps straight to the next character that matters using them.
+ *
+ * Sources are made up of words, character literals ('a'), strings ("abc"),
+ * newlines, parentheses, and brackets. Words are numbers or atoms, and end at
+ * whitespace or a parenthesis or bracket.
+ */
+
+typedef enum {
+    TOKEN_STRING,
+    TOKEN_CHARACTER,
+    // A number or an atom, which the compiler tells apart.
+    TOKEN_WORD,
+    TOKEN_NEWLINE,
+    TOKEN_PARENTHESIS,
+    TOKEN_BRACKET,
+    // End of the source.
+    TOKEN_END
+} TokenType;
+
+typedef struct {
+    // Where the text of the lexeme is in the source. Strings leave out their
+    // quotes.
+    size_t   offset;
+    uint32_t length;
+    // TokenType.
+    uint8_t  type;
+    // What it is depends on the type:
+    // TOKEN_STRING - 1 if it has escape sequences in it, else 0, see
+    // string_decode.
+    // TOKEN_CHARACTER - the character, with any escape sequence replaced.
+    // TOKEN_PARENTHESIS, TOKEN_BRACKET - the delimiter itself.
+    uint8_t  payload;
+} Lexeme;
+
+_Static_assert(16 == sizeof(Lexeme) || 8 != sizeof(size_t), "Lexemes should be 16 bytes");
+
+// One bit for each byte of a block in a uint64_t.
+#define LEXER_BLOCK_SIZE 64
+
+typedef struct {
+    const char* source;
+    size_t      length;
+    size_t      index;
+    // Name of the source, for error messages.
+    const char* name;
+    // Masks of the block of the source last classified by lexer_classify.
+    size_t      block_start;
+    uint64_t    not_blank;
+    uint64_t    word_end;
+    uint64_t    string_stop;
+} Lexer;
+
+static Lexer lexer_make(const char *restrict name, const char *restrict source, size_t length) {
+    return (Lexer) {
+        .source      = source,
+        .length      = length,
+        .index       = 0,
+        .name        = name,
+        .block_start = SIZE_MAX
+    };
+}
+
+typedef enum {
+    // Whitespace other than newlines.
+    CHARACTER_BLANK       = 1 << 0,
+    // Whitespace, parentheses, and brackets.
+    CHARACTER_WORD_END    = 1 << 1,
+    // Quotes and backslashes, which are all that matter inside a string.
+    CHARACTER_STRING_STOP = 1 << 2
+} CharacterClass;
+
+/**
+ * What the lexer looks for with lexer_scan.
+ */
+typedef enum {
+    SCAN_NOT_BLANK,
+    SCAN_WORD_END,
+    SCAN_STRING_STOP
+} ScanTarget;
+
+#ifndef TLPIN_SSE2
+static const uint8_t character_classes[256] = {
+    [' ']  = CHARACTER_BLANK | CHARACTER_WORD_END,
+    ['\t'] = CHARACTER_BLANK | CHARACTER_WORD_END,
+    ['\r'] = CHARACTER_BLANK | CHARACTER_WORD_END,
+    ['\v'] = CHARACTER_BLANK | CHARACTER_WORD_END,
+    ['\f'] = CHARACTER_BLANK | CHARACTER_WORD_END,
+    ['\n'] = CHARACTER_WORD_END,
+    ['(']  = CHARACTER_WORD_END,
+    [')']  = CHARACTER_WORD_END,
+    ['{']  = CHARACTER_WORD_END,
+    ['}']  = CHARACTER_WORD_END,
+    ['"']  = CHARACTER_STRING_STOP,
+    ['\\'] = CHARACTER_STRING_STOP
+};
+#endif // TLPIN_SSE2
+
+/**
+ * Classifies the LEXER_BLOCK_SIZE bytes of the source from block_start into the
+ * lexer's masks, with bit i standing for byte block_start + i. Bytes past the
+ * end of the source are in no class.
+ */
+static void lexer_classify(Lexer* lexer, size_t block_start) {
+    char        padded[LEXER_BLOCK_SIZE];
+    const char* block = &lexer->source[block_start];
+    if (lexer->length - block_start < LEXER_BLOCK_SIZE) {
+        (void)memset(padded, 0, sizeof(padded));
+        (void)memcpy(padded, block, lexer->length - block_start);
+        block = padded;
+    }
+
+    uint64_t blank       = 0;
+    uint64_t word_end    = 0;
+    uint64_t string_stop = 0;
+
+#ifdef TLPIN_SSE2
+#define BYTES_EQUAL(bytes, character) _mm_cmpeq_epi8((bytes), _mm_set1_epi8(character))
+#define MASK(bytes) ((uint64_t)(uint16_t)_mm_movemask_epi8(bytes))
+    for (size_t i = 0; i < LEXER_BLOCK_SIZE; i += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i*)&block[i]);
+
+        __m128i blank_bytes = _mm_or_si128(
+            _mm_or_si128(BYTES_EQUAL(bytes, ' '),  BYTES_EQUAL(bytes, '\t')),
+            _mm_or_si128(
+                BYTES_EQUAL(bytes, '\r'),
+                _mm_or_si128(BYTES_EQUAL(bytes, '\v'), BYTES_EQUAL(bytes, '\f'))
+            )
+        );
+        __m128i delimiter_bytes = _mm_or_si128(
+            _mm_or_si128(BYTES_EQUAL(bytes, '('), BYTES_EQUAL(bytes, ')')),
+            _mm_or_si128(BYTES_EQUAL(bytes, '{'), BYTES_EQUAL(bytes, '}'))
+        );
+        __m128i string_stop_bytes = _mm_or_si128(BYTES_EQUAL(bytes, '"'), BYTES_EQUAL(bytes, '\\'));
+
+        __m128i word_end_bytes = _mm_or_si128(
+            _mm_or_si128(blank_bytes, delimiter_bytes),
+            BYTES_EQUAL(bytes, '\n')
+        );
+
+        blank       |= MASK(blank_bytes)       << i;
+        word_end    |= MASK(word_end_bytes)    << i;
+        string_stop |= MASK(string_stop_bytes) << i;
+    }
+#undef MASK
+#undef BYTES_EQUAL
+#else  // TLPIN_SSE2
+    for (size_t i = 0; i < LEXER_BLOCK_SIZE; ++i) {
+        uint64_t class = character_classes[(uint8_t)block[i]];
+        blank       |= ((class & CHARACTER_BLANK)       >> 0) << i;
+        word_end    |= ((class & CHARACTER_WORD_END)    >> 1) << i;
+        string_stop |= ((class & CHARACTER_STRING_STOP) >> 2) << i;
+    }
+#endif // TLPIN_SSE2
+
+    lexer->block_start = block_start;
+    lexer->not_blank   = ~blank;
+    lexer->word_end    = word_end;
+    lexer->string_stop = string_stop;
+}
+
+/**
+ * Finds the first byte from index onwards that the target is looking for, or
+ * the end of the source if there isn't one.
+ */
+static size_t lexer_scan(Lexer* lexer, size_t index, ScanTarget target) {
+    while (index < lexer->length) {
+        size_t block_start = index - index % LEXER_BLOCK_SIZE;
+        if (block_start != lexer->block_start) lexer_classify(lexer, block_start);
+
+        uint64_t mask;
+        switch (target) {
+        case SCAN_NOT_BLANK:   mask = lexer->not_blank;   break;
+        case SCAN_WORD_END:    mask = lexer->word_end;    break;
+        case SCAN_STRING_STOP: mask = lexer->string_stop; break;
+        default:               assert(0 && "Unreachable");
+        }
+
+        mask >>= index - block_start;
+        if (0 != mask) {
+            size_t found = index + (size_t)__builtin_ctzll(mask);
+            return found < lexer->length ? found : lexer->length;
+        }
+        index = block_start + LEXER_BLOCK_SIZE;
+    }
+
+    return lexer->length;
+}
+
+/**
+ * Works out the line and column of the offset in the source, both starting
+ * from 1. Only meant for error messages, since it has to go over the source up
+ * to the offset.
+ */
+static void source_position( const char *restrict source
+                           , size_t offset
+                           , size_t *restrict line
+                           , size_t *restrict column) {
+    size_t line_start = 0;
+    *line = 1;
+
+    for (;;) {
+        const char* newline = memchr(&source[line_start], '\n', offset - line_start);
+        if (NULL == newline) break;
+        line_start = (size_t)(newline - source) + 1;
+        ++*line;
+    }
+
+    *column = offset - line_start + 1;
+}
+
+/**
+ * Prints out an error at the offset in the source.
+ */
+static void lexer_error( const Lexer *restrict lexer
+                       , size_t offset
+                       , const char *restrict message) {
+    size_t line, column;
+    source_position(lexer->source, offset, &line, &column);
+    (void)fprintf(stderr, "%s(%zu:%zu): Error: %s\n", lexer->name, line, column, message);
+}
+
+/**
+ * Reads a possibly escaped character from the text. Returns false on an
+ * unknown escape sequence.
+ */
+static bool read_character( const char *restrict text
+                          , size_t length
+                          , size_t *restrict index
+                          , uint8_t *restrict character) {
+    if ('\\' != text[*index]) {
+        *character = (uint8_t)text[(*index)++];
+        return true;
+    }
+
+    if (++*index >= length) return false;
+    switch (text[(*index)++]) {
+    case '\\': *character = '\\'; break;
+    case '\'': *character = '\''; break;
+    case '"':  *character = '"';  break;
+    case 'n':  *character = '\n'; break;
+    case 't':  *character = '\t'; break;
+    default:   return false;
+    }
+    return true;
+}
+
+/**
+ * Appends the characters of the string lexeme to the array, replacing any
+ * escape sequences.
+ */
+static void string_decode( const char *restrict source
+                         , const Lexeme *restrict lexeme
+                         , ValueArray *restrict characters) {
+    const char* text = &source[lexeme->offset];
+
+    if (0 == lexeme->payload) {
+        if (characters->count + lexeme->length > characters->capacity) {
+            ARRAY_RESIZE(characters, &interpreter->allocator, characters->count + lexeme->length);
+        }
+        for (size_t i = 0; i < lexeme->length; ++i) {
+            Value* character = &characters->elements[characters->count++];
+            character->type         = VALUE_CHARACTER;
+            character->as_character = (uint8_t)text[i];
+        }
+        return;
+    }
+
+    size_t index = 0;
+    while (index < lexeme->length) {
+        Value character = { .type = VALUE_CHARACTER };
+        bool  known     = read_character(text, lexeme->length, &index, &character.as_character);
+        assert(known && "Escape sequences are checked by the lexer");
+        (void)known;
+        ARRAY_APPEND(characters, &interpreter->allocator, character);
+    }
+}
+
+/**
+ * Finishes the lexeme at the lexer's position. Returns false if it's too long
+ * to fit in a lexeme.
+ */
+static bool lexeme_end(const Lexer *restrict lexer, Lexeme *restrict lexeme) {
+    size_t length = lexer->index - lexeme->offset;
+    if (length > UINT32_MAX) {
+        lexer_error(lexer, lexeme->offset, "Token longer than 4 GiB");
+        return false;
+    }
+    lexeme->length = (uint32_t)length;
+    return true;
+}
+
+static bool lex_string(Lexer *restrict lexer, Lexeme *restrict lexeme) {
+    lexeme->type    = TOKEN_STRING;
+    lexeme->payload = 0;
+    // Skips past first quote, which errors point to.
+    lexeme->offset = ++lexer->index;
+
+    for (;;) {
+        lexer->index = lexer_scan(lexer, lexer->index, SCAN_STRING_STOP);
+        if (lexer->index >= lexer->length) {
+            lexer_error(lexer, lexeme->offset - 1, "Unterminated string");
+            return false;
+        }
+        if ('"' == lexer->source[lexer->index]) break;
+        lexeme->payload = 1;
+
+        uint8_t unescaped;
+        if (!read_character(lexer->source, lexer->length, &lexer->index, &unescaped)) {
+            lexer_error(lexer, lexeme->offset - 1, "Unknown escape sequence in string");
+            return false;
+        }
+    }
+    if (!lexeme_end(lexer, lexeme)) return false;
+    ++lexer->index;
+
+    return true;
+}
+
+static bool lex_character_literal(Lexer *restrict lexer, Lexeme *restrict lexeme) {
+    lexeme->type = TOKEN_CHARACTER;
+    // Skips past first quote, which errors point to.
+    lexeme->offset = ++lexer->index;
+
+    if (lexer->index >= lexer->length) goto lunterminated;
+    if (!read_character(lexer->source, lexer->length, &lexer->index, &lexeme->payload)) {
+        lexer_error(lexer, lexeme->offset - 1, "Unknown escape sequence in character literal");
+        return false;
+    }
+    if (lexer->index >= lexer->length || '\'' != lexer->source[lexer->index]) goto lunterminated;
+    (void)lexeme_end(lexer, lexeme);
+    ++lexer->index;
+
+    return true;
+
+ lunterminated:
+    lexer_error(lexer, lexeme->offset - 1, "Unterminated character literal");
+    return false;
+}
+
+static bool lex_word(Lexer *restrict lexer, Lexeme *restrict lexeme) {
+    lexeme->type   = TOKEN_WORD;
+    lexeme->offset = lexer->index;
+    lexer->index   = lexer_scan(lexer, lexer->index, SCAN_WORD_END);
+    return lexeme_end(lexer, lexeme);
+}
+
+/**
+ * Reads the next lexeme from the source, which is TOKEN_END once there are no
+ * more. On failure, prints out what went wrong and returns false.
+ */
+static bool lexer_next(Lexer *restrict lexer, Lexeme *restrict lexeme) {
+    lexer->index = lexer_scan(lexer, lexer->index, SCAN_NOT_BLANK);
+
+    *lexeme = (Lexeme) {
+        .offset  = lexer->index,
+        .length  = 0,
+        .type    = TOKEN_END,
+        .payload = 0
+    };
+    if (lexer->index >= lexer->length) return true;
+
+    char character = lexer->source[lexer->index];
+    switch (character) {
+    case '\n': {
+        lexeme->type   = TOKEN_NEWLINE;
+        lexeme->length = 1;
+        ++lexer->index;
+    } break;
+
+    case '(':
+    case ')': {
+        lexeme->type    = TOKEN_PARENTHESIS;
+        lexeme->payload = (uint8_t)character;
+        lexeme->length  = 1;
+        ++lexer->index;
+    } break;
+
+    case '{':
+    case '}': {
+        lexeme->type    = TOKEN_BRACKET;
+        lexeme->payload = (uint8_t)character;
+        lexeme->length  = 1;
+        ++lexer->index;
+    } break;
+
+    case '"':  return lex_string(lexer, lexeme);
+    case '\'': return lex_character_literal(lexer, lexeme);
+    default:   return lex_word(lexer, lexeme);
+    }
+
+    return true;
+}
+
+/**
+ * Parses the whole text as a decimal number: an optional sign, digits with an
+ * optional decimal point, and an optional exponent. Returns false if it isn't
+ * one. Numbers too big or too small for a float64_t are still parsed, but with
+ * in_range set to false.
+ */
+static bool parse_number( const char *restrict text
+                        , size_t length
+                        , float64_t *restrict number
+                        , bool *restrict in_range) {
+    // strtod also takes things like inf, nan, and hexadecimal, so the syntax is
+    // checked first.
+    size_t i = 0;
+    if (i < length && ('+' == text[i] || '-' == text[i])) ++i;
+
+    size_t digits = 0;
+    for (; i < length && isdigit((unsigned char)text[i]); ++i) ++digits;
+    if (i < length && '.' == text[i]) {
+        ++i;
+        for (; i < length && isdigit((unsigned char)text[i]); ++i) ++digits;
+    }
+    if (0 == digits) return false;
+
+    if (i < length && ('e' == text[i] || 'E' == text[i])) {
+        ++i;
+        if (i < length && ('+' == text[i] || '-' == text[i])) ++i;
+
+        size_t exponent_digits = 0;
+        for (; i < length && isdigit((unsigned char)text[i]); ++i) ++exponent_digits;
+        if (0 == exponent_digits) return false;
+    }
+    if (i != length) return false;
+
+    // strtod needs a terminated string, which the source doesn't have. Anything
+    // too long for the buffer that's still a number is very unusual, so it's
+    // fine for it to take an allocation.
+    char  buffer[64];
+    char* word = length < sizeof(buffer) ? buffer : interpreter_allocate(length + 1, "word");
+    (void)memcpy(word, text, length);
+    word[length] = '\0';
+
+    errno     = 0;
+    *number   = strtod(word, NULL);
+    *in_range = ERANGE != errno;
+
+    if (buffer != word) interpreter_free(word);
+    return true;
+}
+
+
+
+/*
+ * Arenas.
+ *
+ * Programs are laid out in an arena once they're compiled, so each one sits in
+ * a few big blocks in the order it runs, and is freed all at once. Nothing but
+ * the final program goes into it; the parser and the compiler passes work on
+ * the heap.
+ */
+
+typedef struct ArenaBlock ArenaBlock;
+
+struct ArenaBlock {
+    ArenaBlock* next;
+    size_t      size;
+    size_t      used;
+    max_align_t data[];
+};
+
+typedef struct {
+    // Newest block first, which is the one being allocated from.
+    ArenaBlock*       blocks;
+    // Used for the blocks themselves.
+    array_allocator_t allocator;
+} Arena;
+
+/**
+ * Rounds the size up so that allocations stay aligned like malloc's.
+ */
+static size_t arena_round(size_t size) {
+    return (size + sizeof(max_align_t) - 1) / sizeof(max_align_t) * sizeof(max_align_t);
+}
+
+static void* arena_allocate(Arena* arena, size_t size) {
+    size_t      needed = arena_round(size);
+    ArenaBlock* block  = arena->blocks;
+
+    if (NULL == block || block->size - block->used < needed) {
+        size_t block_size = needed > ARENA_BLOCK_SIZE ? needed : ARENA_BLOCK_SIZE;
+        block = arena->allocator.realloc(NULL, sizeof(ArenaBlock) + block_size);
+        if (NULL == block) {
+            (void)fputs("Error: Unable to allocate arena block; buy more RAM lol", stderr);
+            exit(1);
+        }
+        block->next   = arena->blocks;
+        block->size   = block_size;
+        block->used   = 0;
+        arena->blocks = block;
+    }
+
+    void* memory = (unsigned char*)block->data + block->used;
+    block->used += needed;
+    return memory;
+}
+
+/**
+ * Copies the items into a new allocation from the arena.
+ */
+static void* arena_copy(Arena *restrict arena, const void *restrict items, size_t size) {
+    if (0 == size) return NULL;
+    void* copy = arena_allocate(arena, size);
+    (void)memcpy(copy, items, size);
+    return copy;
+}
+
+static void arena_free(Arena* arena) {
+    while (NULL != arena->blocks) {
+        ArenaBlock* block = arena->blocks;
+        arena->blocks = block->next;
+        arena->allocator.free(block);
+    }
+}
+
+
+
+/*
+ * Parsing.
+ *
+ * Turns the lexemes of a source into a program. On top of what the lexer
+ * gives, parentheses group functions into a defun, and brackets group literals
+ * into an array literal, like { 1 2 'a' { "bc" } }. Operators come right after
+ * the defun they apply, with rank taking the number in between, like
+ * { 1 2 3 } ( 2 mute ) wan, which leaves { 2 4 6 }, or
+ * { { 1 2 } { 3 4 } } ( ale ) 1 nena, which leaves { 3 7 }.
+ *
+ * The contents of groups that are still open are kept on stacks, and are only
+ * copied out, at their exact size, once the group is closed.
+ */
+
+typedef struct {
+    const char* name;
+    size_t      length;
+    Error(*native)(ValueArray*);
+} NativeName;
+
+/**
+ * The natives are looked up by a perfect hash of the first and last characters
+ * of their names. Two names hashing to the same slot would initialize it twice,
+ * which -Woverride-init, and therefore the build, complains about, so the hash
+ * has to be changed, or the table made bigger, when a native is added.
+ */
+#define NATIVE_TABLE_SIZE 32
+#define NATIVE_HASH(first, last) (((size_t)(first) + (size_t)(last)) % NATIVE_TABLE_SIZE)
+
+static const NativeName native_names[NATIVE_TABLE_SIZE] = {
+    [NATIVE_HASH('p', 'a')] = { "pona",   4, &native_pona   },
+    [NATIVE_HASH('i', 'e')] = { "ike",    3, &native_ike    },
+    [NATIVE_HASH('m', 'e')] = { "mute",   4, &native_mute   },
+    [NATIVE_HASH('k', 'i')] = { "kipisi", 6, &native_kipisi },
+    [NATIVE_HASH('n', 'a')] = { "nanpa",  5, &native_nanpa  },
+    [NATIVE_HASH('a', 'e')] = { "ale",    3, &native_ale    },
+    [NATIVE_HASH('n', 'n')] = { "nasin",  5, &native_nasin  },
+    [NATIVE_HASH('o', 'n')] = { "olin",   4, &native_olin   },
+    [NATIVE_HASH('o', 'o')] = { "o",      1, &native_o      },
+    [NATIVE_HASH('k', 'e')] = { "kute",   4, &native_kute   },
+    [NATIVE_HASH('k', 'u')] = { "kulupu", 6, &native_kulupu }
+};
+
+/**
+ * Finds the native with the given name, or NULL if there isn't one.
+ */
+static Error(*lookup_native(const char* name, size_t length))(ValueArray*) {
+    if (0 == length) return NULL;
+
+    const NativeName* entry = &native_names[NATIVE_HASH((unsigned char)name[0], (unsigned char)name[length - 1])];
+    if (length == entry->length && 0 == memcmp(entry->name, name, length)) {
+        return entry->native;
+    }
+    return NULL;
+}
+
+typedef struct {
+    const char*  name;
+    size_t       length;
+    FunctionType type;
+} OperatorName;
+
+static const OperatorName operator_names[] = {
+    { "wan",  3, FUNCTION_EACH },
+    { "nena", 4, FUNCTION_RANK }
+};
+
+/**
+ * Finds the operator with the given name. Returns false if there isn't one.
+ */
+static bool lookup_operator(const char *restrict name, size_t length, FunctionType *restrict type) {
+    for (size_t i = 0; i < ARRAY_SIZE(operator_names); ++i) {
+        if (length == operator_names[i].length && 0 == memcmp(operator_names[i].name, name, length)) {
+            *type = operator_names[i].type;
+            return true;
+        }
+    }
+    return false;
+}
+
+typedef struct {
+    FunctionArray functions;
+    Arena         arena;
+} Program;
+
+typedef struct {
+    // '(' or '{'.
+    char   delimiter;
+    // Where the group's contents start on the parser's functions or values.
+    size_t start;
+    // Where the group was opened, for error messages.
+    size_t offset;
+} Group;
+
+typedef ARRAY_OF(Group) GroupArray;
+
+typedef struct {
+    Lexer             lexer;
+    // Open groups, innermost last.
+    GroupArray        groups;
+    // Functions of the program and open defuns.
+    FunctionArray     functions;
+    // Elements of open array literals.
+    ValueArray        values;
+    // Used for the stacks, since they're thrown away after parsing.
+    array_allocator_t allocator;
+} Parser;
+
+/**
+ * Prints out an error at the offset in the source, formatted with printf.
+ */
+__attribute__((format(printf, 3, 4)))
+static void parser_error(const Parser *restrict parser, size_t offset, const char *restrict format, ...) {
+    size_t line, column;
+    source_position(parser->lexer.source, offset, &line, &column);
+    (void)fprintf(stderr, "%s(%zu:%zu): Error: ", parser->lexer.name, line, column);
+
+    va_list arguments;
+    va_start(arguments, format);
+    (void)vfprintf(stderr, format, arguments);
+    va_end(arguments);
+
+    (void)fputc('\n', stderr);
+}
+
+/**
+ * Copies the items into a new allocation of their exact size.
+ */
+static void* parser_copy(const Parser *restrict parser, const void *restrict items, size_t size) {
+    if (0 == size) return NULL;
+    void* copy = parser->allocator.realloc(NULL, size);
+    if (NULL == copy) {
+        (void)fputs("Error: Unable to allocate program; buy more RAM lol", stderr);
+        exit(1);
+    }
+    (void)memcpy(copy, items, size);
+    return copy;
+}
+
+static bool parser_in_array(const Parser* parser) {
+    return 0 != parser->groups.count
+        && '{' == parser->groups.elements[parser->groups.count - 1].delimiter;
+}
+
+/**
+ * Adds the literal to the array literal being parsed, or else to the functions
+ * as a FUNCTION_LITERAL.
+ */
+static void parser_add_literal(Parser* parser, Value literal) {
+    if (parser_in_array(parser)) {
+        ARRAY_APPEND(&parser->values, &parser->allocator, literal);
+    } else {
+        Function function = { .type = FUNCTION_LITERAL, .as_literal = literal };
+        ARRAY_APPEND(&parser->functions, &parser->allocator, function);
+    }
+}
+
+/**
+ * Replaces the defun before the operator, and the rank in between for
+ * FUNCTION_RANK, with the operator. Returns false if they aren't there.
+ *
+ * The defun is kept whole as the body of the operator, rather than just it's
+ * functions, so each application is a call that can be JIT compiled and
+ * memoized.
+ */
+static bool parse_operator(Parser *restrict parser, const Lexeme *restrict lexeme, FunctionType type) {
+    const char* word = &parser->lexer.source[lexeme->offset];
+    // Functions before the innermost open defun aren't part of it.
+    size_t start = 0 == parser->groups.count ? 0 : parser->groups.elements[parser->groups.count - 1].start;
+    size_t end   = parser->functions.count;
+
+    size_t rank = 0;
+    if (FUNCTION_RANK == type) {
+        const Function* literal = end > start ? &parser->functions.elements[end - 1] : NULL;
+        float64_t       number  = NULL != literal && FUNCTION_LITERAL == literal->type
+                                  && VALUE_NUMBER == literal->as_literal.type
+                                ? literal->as_literal.as_number
+                                : -1;
+        if (!(number >= 0 && number <= UINT32_MAX) || (float64_t)(uint32_t)number != number) {
+            parser_error(
+                parser, lexeme->offset,
+                "'%.*s' needs a whole number rank before it", (int)lexeme->length, word
+            );
+            return false;
+        }
+        rank = (size_t)number;
+        --end;
+    }
+
+    if (end <= start || FUNCTION_DEFUN != parser->functions.elements[end - 1].type) {
+        parser_error(parser, lexeme->offset, "'%.*s' needs a defun before it", (int)lexeme->length, word);
+        return false;
+    }
+
+    Function function = { .type = type };
+    function.as_operator = (Operator) {
+        .functions = {
+            .elements = parser_copy(parser, &parser->functions.elements[end - 1], sizeof(Function)),
+            .count    = 1,
+            .capacity = 1
+        },
+        .rank = rank
+    };
+    parser->functions.count = end - 1;
+    ARRAY_APPEND(&parser->functions, &parser->allocator, function);
+    return true;
+}
+
+static bool parse_word(Parser *restrict parser, const Lexeme *restrict lexeme) {
+    const char* word = &parser->lexer.source[lexeme->offset];
+
+    float64_t number;
+    bool      in_range;
+    if (parser_in_array(parser)) {
+        if (!parse_number(word, lexeme->length, &number, &in_range)) {
+            parser_error(
+                parser, lexeme->offset,
+                "Arrays can only have literals in them, not '%.*s'", (int)lexeme->length, word
+            );
+            return false;
+        }
+
+    } else {
+        FunctionType operator_type;
+        if (lookup_operator(word, lexeme->length, &operator_type)) {
+            return parse_operator(parser, lexeme, operator_type);
+        }
+
+        Error(*native)(ValueArray*) = lookup_native(word, lexeme->length);
+        if (NULL != native) {
+            Function function = { .type = FUNCTION_NATIVE, .as_native = native };
+            ARRAY_APPEND(&parser->functions, &parser->allocator, function);
+            return true;
+        }
+
+        if (!parse_number(word, lexeme->length, &number, &in_range)) {
+            parser_error(parser, lexeme->offset, "Unknown word '%.*s'", (int)lexeme->length, word);
+            return false;
+        }
+    }
+
+    if (!in_range) {
+        parser_error(parser, lexeme->offset, "Number '%.*s' is out of range", (int)lexeme->length, word);
+        return false;
+    }
+
+    parser_add_literal(parser, (Value){ .type = VALUE_NUMBER, .as_number = number });
+    return true;
+}
+
+/**
+ * Opens or closes a group. Returns false if it's out of place.
+ */
+static bool parse_delimiter(Parser *restrict parser, const Lexeme *restrict lexeme) {
+    char delimiter = (char)lexeme->payload;
+
+    switch (delimiter) {
+    case '(':
+    case '{': {
+        if ('(' == delimiter && parser_in_array(parser)) {
+            parser_error(parser, lexeme->offset, "Arrays can only have literals in them, not defuns");
+            return false;
+        }
+
+        Group group = {
+            .delimiter = delimiter,
+            .start     = '(' == delimiter ? parser->functions.count : parser->values.count,
+            .offset    = lexeme->offset
+        };
+        ARRAY_APPEND(&parser->groups, &parser->allocator, group);
+        return true;
+    }
+
+    case ')':
+    case '}': {
+        char opening = ')' == delimiter ? '(' : '{';
+        if ( 0 == parser->groups.count
+          || opening != parser->groups.elements[parser->groups.count - 1].delimiter) {
+            parser_error(parser, lexeme->offset, "Unexpected '%c'", delimiter);
+            return false;
+        }
+        Group group = parser->groups.elements[--parser->groups.count];
+
+        if ('(' == opening) {
+            size_t   count    = parser->functions.count - group.start;
+            Function function = { .type = FUNCTION_DEFUN };
+            function.as_defun.functions = (FunctionArray) {
+                .elements = parser_copy(parser, &parser->functions.elements[group.start], count * sizeof(Function)),
+                .count    = count,
+                .capacity = count
+            };
+            parser->functions.count = group.start;
+            ARRAY_APPEND(&parser->functions, &parser->allocator, function);
+
+        } else {
+            size_t count   = parser->values.count - group.start;
+            Value  literal = { .type = VALUE_ARRAY };
+            literal.as_array = (ValueArray) {
+                .elements = parser_copy(parser, &parser->values.elements[group.start], count * sizeof(Value)),
+                .count    = count,
+                .capacity = count
+            };
+            parser->values.count = group.start;
+            parser_add_literal(parser, literal);
+        }
+        return true;
+    }
+
+    default: assert(0 && "Unreachable");
+    }
+}
+
+/**
+ * Parses the lexemes into functions. Whatever was parsed before an error is
+ * left on the parser's stacks.
+ */
+static bool parse_program(Parser *restrict parser, FunctionArray *restrict functions) {
+    for (;;) {
+        Lexeme lexeme;
+        if (!lexer_next(&parser->lexer, &lexeme)) return false;
+
+        switch ((TokenType)lexeme.type) {
+        case TOKEN_END: {
+            if (0 != parser->groups.count) {
+                Group* group = &parser->groups.elements[parser->groups.count - 1];
+                parser_error(parser, group->offset, "Unclosed '%c'", group->delimiter);
+                return false;
+            }
+
+            *functions = (FunctionArray) {
+                .elements = parser_copy(parser, parser->functions.elements, parser->functions.count * sizeof(Function)),
+                .count    = parser->functions.count,
+                .capacity = parser->functions.count
+            };
+            return true;
+        }
+
+        case TOKEN_NEWLINE: break;
+
+        case TOKEN_STRING: {
+            Value literal = { .type = VALUE_ARRAY };
+            string_decode(parser->lexer.source, &lexeme, &literal.as_array);
+            parser_add_literal(parser, literal);
+        } break;
+
+        case TOKEN_CHARACTER: {
+            parser_add_literal(parser, (Value){ .type = VALUE_CHARACTER, .as_character = lexeme.payload });
+        } break;
+
+        case TOKEN_WORD: {
+            if (!parse_word(parser, &lexeme)) return false;
+        } break;
+
+        case TOKEN_PARENTHESIS:
+        case TOKEN_BRACKET: {
+            if (!parse_delimiter(parser, &lexeme)) return false;
+        } break;
+
+        default: assert(0 && "Unreachable");
+        }
+    }
+}
 
-    char command[a->as_array.count + 1];
-    command[a->as_array.count] = '\0';
+/**
+ * Frees the underlying memory of the function, if there is any.
+ */
+static void function_free(Function* function) {
+    switch (function->type) {
+    case FUNCTION_DEFUN: {
+        FunctionArray* functions = &function->as_defun.functions;
+        for (size_t i = 0; i < functions->count; ++i) {
+            function_free(&functions->elements[i]);
+        }
+        ARRAY_FREE(functions, &interpreter->allocator);
+        jit_code_free(&function->as_defun.jit_code);
+    } break;
 
-    for (size_t i = 0; i < a->as_array.count; ++i) {
-        Value* element = &a->as_array.elements[i];
-        if (VALUE_CHARACTER != element->type) {
-            return ERROR_DOMAIN;
+    case FUNCTION_EACH:
+    case FUNCTION_RANK:
+    case FUNCTION_FORK: {
+        FunctionArray* functions = &function->as_operator.functions;
+        for (size_t i = 0; i < functions->count; ++i) {
+            function_free(&functions->elements[i]);
         }
+        ARRAY_FREE(functions, &interpreter->allocator);
+    } break;
 
-        command[i] = (char)element->as_character;
-    }
+    case FUNCTION_LITERAL: {
+        value_free(&function->as_literal);
+    } break;
 
-    system(command);
+    case FUNCTION_NATIVE: break;
 
-    --stack->count;
-    return ERROR_OK;
+    default: assert(0 && "Unreachable");
+    };
+}
+
+/**
+ * Replaces the elements of the literal, and of any arrays nested in it, with
+ * copies in the arena.
+ */
+static void value_layout(Arena *restrict arena, Value *restrict value) {
+    if (VALUE_ARRAY != value->type) return;
+
+    ValueArray* array = &value->as_array;
+    array->elements = arena_copy(arena, array->elements, array->count * sizeof(Value));
+    array->capacity = array->count;
+    for (size_t i = 0; i < array->count; ++i) {
+        value_layout(arena, &array->elements[i]);
+    }
 }
 
-Error execute_functions(const FunctionArray* functions, ValueArray* stack) {
+/**
+ * Replaces the functions, and everything they hold on to, with copies in the
+ * arena. Each array comes right before the ones nested in it, so the program
+ * ends up in about the order it runs in.
+ */
+static void functions_layout(Arena *restrict arena, FunctionArray *restrict functions) {
+    functions->elements = arena_copy(arena, functions->elements, functions->count * sizeof(Function));
+    functions->capacity = functions->count;
+
     for (size_t i = 0; i < functions->count; ++i) {
-        const Function* function = &functions->elements[i];
-        Error result;
+        Function* function = &functions->elements[i];
 
         switch (function->type) {
         case FUNCTION_DEFUN: {
-            result = execute_functions(&function->as_defun, stack);
+            functions_layout(arena, &function->as_defun.functions);
         } break;
-        case FUNCTION_NATIVE: {
-            result = function->as_native(stack);
+
+        case FUNCTION_EACH:
+        case FUNCTION_RANK:
+        case FUNCTION_FORK: {
+            functions_layout(arena, &function->as_operator.functions);
         } break;
+
         case FUNCTION_LITERAL: {
-            ARRAY_APPEND(
-                stack,
-                &array_stdlib_allocator,
-                value_deep_copy(&function->as_literal)
-            );
-            result = ERROR_OK;
+            value_layout(arena, &function->as_literal);
+        } break;
+
+        case FUNCTION_NATIVE: break;
+
+        default: assert(0 && "Unreachable");
+        }
+    }
+}
+
+/**
+ * Compiles the source into a program, running the inlining and dataflow passes
+ * over it. The name is used for error messages. On failure, prints out what
+ * went wrong and returns false.
+ *
+ * Parsing and the passes build the program on the heap, throwing away and
+ * replacing arrays as they go, and only the result is copied into the
+ * program's arena.
+ */
+static bool compile_program( const char *restrict name
+                           , const char *restrict source
+                           , size_t length
+                           , Program *restrict program) {
+    *program = (Program) {
+        .functions = {0},
+        .arena     = { .blocks = NULL, .allocator = interpreter->allocator }
+    };
+    Parser parser = {
+        .lexer     = lexer_make(name, source, length),
+        .groups    = {0},
+        .functions = {0},
+        .values    = {0},
+        .allocator = interpreter->allocator
+    };
+
+    FunctionArray functions = {0};
+    bool          parsed    = parse_program(&parser, &functions);
+    if (parsed) {
+        inline_defuns(&functions);
+        if (interpreter->dataflow_enabled) parallelize_regions(&functions);
+
+        program->functions = functions;
+        functions_layout(&program->arena, &program->functions);
+
+        Function program_defun = { .type = FUNCTION_DEFUN, .as_defun = { .functions = functions } };
+        function_free(&program_defun);
+    } else {
+        // Whatever was parsed so far is still on the stacks.
+        for (size_t i = 0; i < parser.functions.count; ++i) function_free(&parser.functions.elements[i]);
+        for (size_t i = 0; i < parser.values.count;    ++i) value_free(&parser.values.elements[i]);
+    }
+
+    ARRAY_FREE(&parser.groups,    &parser.allocator);
+    ARRAY_FREE(&parser.functions, &parser.allocator);
+    ARRAY_FREE(&parser.values,    &parser.allocator);
+    return parsed;
+}
+
+#ifdef TLPIN_JIT
+/**
+ * Frees the JIT code of the defuns in the functions, which lives outside the
+ * arena.
+ */
+static void functions_free_jit_code(FunctionArray* functions) {
+    for (size_t i = 0; i < functions->count; ++i) {
+        Function* function = &functions->elements[i];
+
+        switch (function->type) {
+        case FUNCTION_DEFUN: {
+            functions_free_jit_code(&function->as_defun.functions);
+            jit_code_free(&function->as_defun.jit_code);
+        } break;
+
+        case FUNCTION_EACH:
+        case FUNCTION_RANK:
+        case FUNCTION_FORK: {
+            functions_free_jit_code(&function->as_operator.functions);
         } break;
+
+        case FUNCTION_NATIVE:
+        case FUNCTION_LITERAL: break;
+
         default: assert(0 && "Unreachable");
-        };
+        }
+    }
+}
+#endif // TLPIN_JIT
+
+static void program_free(Program* program) {
+#ifdef TLPIN_JIT
+    functions_free_jit_code(&program->functions);
+#endif // TLPIN_JIT
+    arena_free(&program->arena);
+    program->functions = (FunctionArray){0};
+}
+
 
+
+// The REPL, sources, and batch mode are only used by the tlpin command.
+#ifndef TLPIN_LIBRARY
+/*
+ * REPL.
+ *
+ * Keeps the stack and everything compiled so far alive between lines, so only
+ * the newly entered line needs to be compiled, and large values loaded earlier
+ * in the session stay put.
+ *
+ * Each line is compiled as a program of it's own.
+ */
+
+typedef struct {
+    ValueArray stack;
+    // Every line compiled so far. They're kept around since warm state, like
+    // JIT code and memoized results, refers to them.
+    ARRAY_OF(Program) lines;
+} Session;
+
+static void session_free(Session* session) {
+    for (size_t i = 0; i < session->stack.count; ++i) {
+        value_free(&session->stack.elements[i]);
+    }
+    ARRAY_FREE(&session->stack, &interpreter->allocator);
+
+    for (size_t i = 0; i < session->lines.count; ++i) {
+        program_free(&session->lines.elements[i]);
+    }
+    ARRAY_FREE(&session->lines, &interpreter->allocator);
+}
+
+/**
+ * Reads lines from stdin and runs them on the session until end of input.
+ */
+static void run_repl(Session* session) {
+    bool   interactive = isatty(STDIN_FILENO);
+    char*  line        = NULL;
+    size_t line_size   = 0;
+
+    for (;;) {
+        if (interactive) {
+            (void)fputs("> ", stdout);
+            (void)fflush(stdout);
+        }
+
+        ssize_t length = getline(&line, &line_size, stdin);
+        if (length < 0) break;
+
+        Program program;
+        if (!compile_program("<stdin>", line, (size_t)length, &program)) continue;
+        ARRAY_APPEND(&session->lines, &interpreter->allocator, program);
+
+        budget_start();
+        Error result = execute_functions(&program.functions, &session->stack);
         if (ERROR_OK != result) {
-            return result;
+            (void)fprintf(stderr, "%s\n", error_message(result));
         }
+
+        (void)printf("Stack dump: ");
+        dump_stack(stdout, &session->stack);
+        (void)printf("\n");
     }
 
-    return ERROR_OK;
+    free(line);
+    if (interactive) (void)fputs("\n", stdout);
 }
 
 
 
-/* #define SOURCE_FILE     "test.tlpin" */
-/* #define READ_CHUNK_SIZE 1024 */
+/*
+ * Sources.
+ *
+ * Program files are mapped into memory rather than read, so even huge
+ * generated programs are compiled straight from the page cache without being
+ * copied. Anything that can't be mapped, like pipes, is read in instead.
+ */
 
-void dump_stack(const ValueArray* stack) {
-    for (size_t i = 0; i < stack->count; ++i) {
-        const Value* value = &stack->elements[i];
+typedef struct {
+    const char* contents;
+    size_t      length;
+    // Whether contents is mapped, or else allocated.
+    bool        mapped;
+} Source;
 
-        switch (value->type) {
-        case VALUE_NUMBER:    (void)printf("%lf ", value->as_number);    break;
-        case VALUE_CHARACTER: (void)printf("%c ",  value->as_character); break;
+/**
+ * Reads what's left of the file into a newly allocated buffer, which starts out
+ * big enough for size_hint bytes. Returns false and sets errno on failure.
+ */
+static bool source_read(int file, size_t size_hint, Source* source) {
+    size_t capacity = 0 == size_hint ? 4096 : size_hint + 1;
+    size_t length   = 0;
+    char*  contents = NULL;
+
+    for (;;) {
+        if (length == capacity || NULL == contents) {
+            if (NULL != contents) capacity *= ARRAY_CAPACITY_MULTIPLIER;
+            char* resized = realloc(contents, capacity);
+            if (NULL == resized) {
+                (void)fputs("Error: Unable to allocate source buffer; buy more RAM lol", stderr);
+                exit(1);
+            }
+            contents = resized;
+        }
 
-        case VALUE_ARRAY: {
-            (void)printf("{ ");
-            dump_stack(&value->as_array);
-            (void)printf("} ");
-        } break;
+        ssize_t count = read(file, &contents[length], capacity - length);
+        if (count < 0 && EINTR == errno) continue;
+        if (count < 0) {
+            int error = errno;
+            free(contents);
+            errno = error;
+            return false;
+        }
+        if (0 == count) break;
+        length += (size_t)count;
+    }
 
-        default: assert(0 && "Unreachable");
-        };
+    *source = (Source) { .contents = contents, .length = length, .mapped = false };
+    return true;
+}
+
+/**
+ * Loads the file at the path. Returns false and sets errno on failure.
+ */
+static bool source_load(const char *restrict path, Source *restrict source) {
+    int file = open(path, O_RDONLY);
+    if (-1 == file) return false;
+
+    struct stat status;
+    if (-1 == fstat(file, &status)) goto lfail;
+
+    if (S_ISREG(status.st_mode) && status.st_size > 0) {
+        size_t length   = (size_t)status.st_size;
+        void*  contents = mmap(NULL, length, PROT_READ, MAP_PRIVATE, file, 0);
+        if (MAP_FAILED != contents) {
+            (void)madvise(contents, length, MADV_SEQUENTIAL);
+            (void)close(file);
+            *source = (Source) { .contents = contents, .length = length, .mapped = true };
+            return true;
+        }
+    }
+
+    // Pipes and such, and files that can't be mapped for whatever reason.
+    if (!source_read(file, S_ISREG(status.st_mode) ? (size_t)status.st_size : 0, source)) {
+        goto lfail;
+    }
+    (void)close(file);
+    return true;
+
+ lfail: {
+        int error = errno;
+        (void)close(file);
+        errno = error;
+        return false;
     }
 }
 
-#define ARRAY_SIZE(array) sizeof(array)/sizeof(array[0])
+static void source_free(Source* source) {
+    if (source->mapped) (void)munmap((void*)source->contents, source->length);
+    else                free((void*)source->contents);
+}
+
+/**
+ * Loads and compiles the program file. On failure, prints out what went wrong
+ * and returns false.
+ */
+static bool compile_file(const char *restrict path, Program *restrict program) {
+    Source source;
+    if (!source_load(path, &source)) {
+        (void)fprintf(stderr, "Error: Unable to read program '%s': %s\n", path, strerror(errno));
+        return false;
+    }
+
+    bool compiled = compile_program(path, source.contents, source.length, program);
+    source_free(&source);
+    return compiled;
+}
+
+
+
+/*
+ * Batch mode.
+ *
+ * Runs one program over many input files. The program is compiled once and
+ * shared by every run, each of which starts with the contents of it's input as
+ * a character array on an otherwise empty stack. Every thread of the pool gets
+ * it's own interpreter, so runs have separate budgets and don't fight over the
+ * memoization cache, and takes inputs from a shared counter until there are
+ * none left, so a slow input doesn't hold up the rest. Outputs are written in
+ * the order of the inputs, as soon as everything before them is written.
+ *
+ * Commands run by o write straight to stdout, so they don't keep to the order.
+ */
+
+typedef struct {
+    Program*        program;
+    char**          inputs;
+    size_t          input_count;
+    // Next input to be taken by a worker.
+    _Atomic size_t  next_input;
+    // What each input printed, NULL until it's done.
+    char**          outputs;
+    size_t*         output_lengths;
+    // How many outputs have been written to stdout.
+    size_t          written;
+    bool            failed;
+    pthread_mutex_t lock;
+} Batch;
+
+/**
+ * Runs the program on the input, printing the resulting stack, or what went
+ * wrong, to the output. Returns false on failure.
+ */
+static bool batch_run(Batch *restrict batch, size_t index, FILE *restrict output) {
+    const char* path = batch->inputs[index];
 
-const Function initial_program[] = {
-    {
-        .type = FUNCTION_LITERAL,
-        .as_literal = {
-            .type = VALUE_CHARACTER,
-            .as_character = 'l'
-        }
-    },
-    {
-        .type = FUNCTION_LITERAL,
-        .as_literal = {
-            .type = VALUE_CHARACTER,
-            .as_character = 's'
-        }
-    },
-    {
-        .type = FUNCTION_NATIVE,
-        .as_native = &native_olin
-    },
-    {
-        .type = FUNCTION_NATIVE,
-        .as_native = &native_o
+    int file = open(path, O_RDONLY);
+    if (-1 == file) {
+        (void)fprintf(output, "Error: Unable to open input '%s': %s\n", path, strerror(errno));
+        return false;
     }
+    Value input = { .type = VALUE_ARRAY };
+    while (read_characters(file, &input.as_array));
+    (void)close(file);
+
+    ValueArray stack = {0};
+    ARRAY_APPEND(&stack, &interpreter->allocator, input);
+
+    budget_start();
+    Error result = execute_functions(&batch->program->functions, &stack);
+    if (ERROR_OK == result) {
+        (void)fputs("Stack dump: ", output);
+        dump_stack(output, &stack);
+        (void)fputs("\n", output);
+    } else {
+        (void)fprintf(output, "Error: Input '%s': %s\n", path, error_message(result));
+    }
+
+    for (size_t i = 0; i < stack.count; ++i) {
+        value_free(&stack.elements[i]);
+    }
+    ARRAY_FREE(&stack, &interpreter->allocator);
+
+    return ERROR_OK == result;
+}
+
+/**
+ * Hands in the output of the input, writing out every output that's next in
+ * line.
+ */
+static void batch_finish(Batch *restrict batch, size_t index, char *restrict output, size_t output_length, bool succeeded) {
+    (void)pthread_mutex_lock(&batch->lock);
+
+    batch->outputs[index]        = output;
+    batch->output_lengths[index] = output_length;
+    if (!succeeded) batch->failed = true;
+
+    while (batch->written < batch->input_count && NULL != batch->outputs[batch->written]) {
+        (void)fwrite(batch->outputs[batch->written], 1, batch->output_lengths[batch->written], stdout);
+        free(batch->outputs[batch->written]);
+        ++batch->written;
+    }
+    (void)fflush(stdout);
+
+    (void)pthread_mutex_unlock(&batch->lock);
+}
+
+/**
+ * Each index is a worker, which runs inputs until there are none left.
+ */
+static void batch_task_body(void* context, size_t start, size_t end) {
+    Batch* batch = context;
+    (void)start;
+    (void)end;
+
+    // Takes the settings and limits of the batch's interpreter, but not it's
+    // memoization cache.
+    Interpreter  worker_interpreter   = *interpreter;
+    Interpreter* previous_interpreter = interpreter;
+    worker_interpreter.memo_cache = (MemoCache){0};
+    (void)pthread_mutex_init(&worker_interpreter.memo_cache.lock, NULL);
+    interpreter = &worker_interpreter;
+
+    for (;;) {
+        size_t index = atomic_fetch_add(&batch->next_input, 1);
+        if (index >= batch->input_count) break;
+
+        char*  output        = NULL;
+        size_t output_length = 0;
+        FILE*  output_file   = open_memstream(&output, &output_length);
+        if (NULL == output_file) {
+            (void)fputs("Error: Unable to allocate batch output; buy more RAM lol", stderr);
+            exit(1);
+        }
+        bool succeeded = batch_run(batch, index, output_file);
+        (void)fclose(output_file);
+
+        batch_finish(batch, index, output, output_length, succeeded);
+    }
+
+    memo_cache_free();
+    (void)pthread_mutex_destroy(&worker_interpreter.memo_cache.lock);
+    interpreter = previous_interpreter;
+}
+
+/**
+ * Runs the program in the file over each of the inputs. Returns the exit code
+ * for tlpin, which is 1 if any of them failed.
+ */
+static int run_batch(const char* program_path, char** inputs, size_t input_count) {
+    Program program;
+    if (!compile_file(program_path, &program)) return 1;
+
+    // Still compiled, so mistakes in the program get reported.
+    if (0 == input_count) {
+        program_free(&program);
+        return 0;
+    }
+
+    Batch batch = {
+        .program        = &program,
+        .inputs         = inputs,
+        .input_count    = input_count,
+        .next_input     = 0,
+        .outputs        = calloc(input_count, sizeof(char*)),
+        .output_lengths = calloc(input_count, sizeof(size_t)),
+        .written        = 0,
+        .failed         = false
+    };
+    if (NULL == batch.outputs || NULL == batch.output_lengths) {
+        (void)fputs("Error: Unable to allocate batch outputs; buy more RAM lol", stderr);
+        exit(1);
+    }
+    (void)pthread_mutex_init(&batch.lock, NULL);
+
+    parallel_for(thread_pool_size(), 1, &batch_task_body, &batch);
+
+    (void)pthread_mutex_destroy(&batch.lock);
+    free(batch.outputs);
+    free(batch.output_lengths);
+    program_free(&program);
+
+    return batch.failed ? 1 : 0;
+}
+#endif // TLPIN_LIBRARY
+
+
+
+/*
+ * Library.
+ *
+ * See tlpin.h. Every call makes the context's interpreter the current one for
+ * as long as it runs, so the rest of the interpreter doesn't have to know about
+ * contexts.
+ */
+
+struct TlpinContext {
+    Interpreter   interpreter;
+    ValueArray    stack;
+    Program       program;
 };
 
-int main(void) {
-    /* FILE* source = fopen(SOURCE_FILE, "r"); */
-    /* if (NULL == source) { */
-    /*     perror("Error: Unable to open file '" SOURCE_FILE "'"); */
-    /*     return 1; */
-    /* }; */
-    /* sstring_t contents = sstring_read_file(source, READ_CHUNK_SIZE, &realloc); */
-    /* (void)fclose(source); */
+TlpinOptions tlpin_options_default(void) {
+    return (TlpinOptions) {
+        .realloc  = NULL,
+        .free     = NULL,
+        .fuel     = -1,
+        .timeout  = -1,
+        .jit      = default_interpreter.jit_enabled,
+        .memoize  = default_interpreter.memoize_enabled,
+        .lazy     = default_interpreter.lazy_enabled,
+        .quicken  = default_interpreter.quicken_enabled,
+        .dataflow = default_interpreter.dataflow_enabled
+    };
+}
+
+/**
+ * Makes the context's interpreter the current one, returning the previous one
+ * for context_leave.
+ */
+static Interpreter* context_enter(TlpinContext* context) {
+    Interpreter* previous_interpreter = interpreter;
+    interpreter = &context->interpreter;
+    return previous_interpreter;
+}
+
+static void context_leave(Interpreter* previous_interpreter) {
+    interpreter = previous_interpreter;
+}
+
+static TlpinError tlpin_error_from(Error error) {
+    switch (error) {
+    case ERROR_OK:              return TLPIN_OK;
+    case ERROR_DOMAIN:          return TLPIN_ERROR_DOMAIN;
+    case ERROR_SHAPE:           return TLPIN_ERROR_SHAPE;
+    case ERROR_STACK_UNDERFLOW: return TLPIN_ERROR_STACK_UNDERFLOW;
+    case ERROR_OUT_OF_FUEL:     return TLPIN_ERROR_OUT_OF_FUEL;
+    case ERROR_TIMED_OUT:       return TLPIN_ERROR_TIMED_OUT;
+    case ERROR_GUARD:
+    default:                    assert(0 && "Unreachable");
+    }
+}
+
+TlpinContext* tlpin_create(const TlpinOptions* options) {
+    // Memory from one allocator can't be given back to the other.
+    if ((NULL == options->realloc) != (NULL == options->free)) return NULL;
+    // Also catches NaN.
+    if (!(options->timeout < 0 || options->timeout <= BUDGET_TIME_LIMIT_MAX)) return NULL;
+
+    array_allocator_t allocator = array_stdlib_allocator;
+    if (NULL != options->realloc) {
+        allocator = (array_allocator_t){ .realloc = options->realloc, .free = options->free };
+    }
+
+    TlpinContext* context = allocator.realloc(NULL, sizeof(TlpinContext));
+    if (NULL == context) return NULL;
+
+    *context = (TlpinContext) {
+        .interpreter = {
+            .allocator        = allocator,
+            .jit_enabled      = options->jit,
+            .memoize_enabled  = options->memoize,
+            .lazy_enabled     = options->lazy,
+            .quicken_enabled  = options->quicken,
+            .dataflow_enabled = options->dataflow,
+            .budget           = {
+                .fuel_limited = options->fuel >= 0,
+                .fuel_limit   = options->fuel,
+                .time_limited = options->timeout >= 0,
+                .time_limit   = options->timeout
+            }
+        },
+        .stack   = {0},
+        .program = {
+            .functions = {0},
+            .arena     = { .blocks = NULL, .allocator = allocator }
+        }
+    };
+    (void)pthread_mutex_init(&context->interpreter.memo_cache.lock, NULL);
+
+    return context;
+}
+
+static void context_program_free(TlpinContext* context) {
+    program_free(&context->program);
+    // Memoized results are keyed by the program's defuns, which are gone now.
+    memo_cache_free();
+}
+
+TlpinError tlpin_compile(TlpinContext* context, const char* source, size_t length) {
+    Interpreter* previous_interpreter = context_enter(context);
+
+    Program program;
+    if (!compile_program("<source>", source, length, &program)) {
+        context_leave(previous_interpreter);
+        return TLPIN_ERROR_SYNTAX;
+    }
+
+    context_program_free(context);
+    context->program = program;
+
+    context_leave(previous_interpreter);
+    return TLPIN_OK;
+}
+
+TlpinError tlpin_run(TlpinContext* context) {
+    Interpreter* previous_interpreter = context_enter(context);
+
+    budget_start();
+    Error result = execute_functions(&context->program.functions, &context->stack);
+
+    context_leave(previous_interpreter);
+    return tlpin_error_from(result);
+}
+
+size_t tlpin_stack_count(const TlpinContext* context) {
+    return context->stack.count;
+}
+
+void tlpin_push_number(TlpinContext* context, double number) {
+    Interpreter* previous_interpreter = context_enter(context);
+
+    Value value = { .type = VALUE_NUMBER, .as_number = number };
+    ARRAY_APPEND(&context->stack, &interpreter->allocator, value);
+
+    context_leave(previous_interpreter);
+}
+
+void tlpin_push_string(TlpinContext* context, const char* string, size_t length) {
+    Interpreter* previous_interpreter = context_enter(context);
+
+    Value value = { .type = VALUE_ARRAY };
+    for (size_t i = 0; i < length; ++i) {
+        Value character = { .type = VALUE_CHARACTER, .as_character = (uint8_t)string[i] };
+        ARRAY_APPEND(&value.as_array, &interpreter->allocator, character);
+    }
+    ARRAY_APPEND(&context->stack, &interpreter->allocator, value);
+
+    context_leave(previous_interpreter);
+}
+
+/**
+ * Finds the value index values down from the top of the stack, forcing it if
+ * it's lazy. Returns NULL if the stack isn't that deep.
+ */
+static Value* context_stack_value(TlpinContext* context, size_t index) {
+    if (index >= context->stack.count) return NULL;
+    Value* value = &context->stack.elements[context->stack.count - 1 - index];
+    value_force(value);
+    return value;
+}
+
+TlpinError tlpin_get_number(TlpinContext* context, size_t index, double* number) {
+    Interpreter* previous_interpreter = context_enter(context);
+    Value*       value                = context_stack_value(context, index);
+    context_leave(previous_interpreter);
+
+    if (NULL == value)               return TLPIN_ERROR_INDEX;
+    if (VALUE_NUMBER != value->type) return TLPIN_ERROR_TYPE;
+    *number = value->as_number;
+    return TLPIN_OK;
+}
+
+TlpinError tlpin_get_string( TlpinContext* context
+                           , size_t index
+                           , char* buffer
+                           , size_t size
+                           , size_t* length) {
+    Interpreter* previous_interpreter = context_enter(context);
+    Value*       value                = context_stack_value(context, index);
+    context_leave(previous_interpreter);
+
+    if (NULL == value)              return TLPIN_ERROR_INDEX;
+    if (VALUE_ARRAY != value->type) return TLPIN_ERROR_TYPE;
+    const ValueArray* characters = &value->as_array;
+    for (size_t i = 0; i < characters->count; ++i) {
+        if (VALUE_CHARACTER != characters->elements[i].type) return TLPIN_ERROR_TYPE;
+    }
+
+    *length = characters->count;
+    if (0 == size) return TLPIN_OK;
+    size_t copied = characters->count < size - 1 ? characters->count : size - 1;
+    for (size_t i = 0; i < copied; ++i) {
+        buffer[i] = (char)characters->elements[i].as_character;
+    }
+    buffer[copied] = '\0';
+    return TLPIN_OK;
+}
+
+void tlpin_stack_clear(TlpinContext* context) {
+    Interpreter* previous_interpreter = context_enter(context);
+
+    for (size_t i = 0; i < context->stack.count; ++i) {
+        value_free(&context->stack.elements[i]);
+    }
+    context->stack.count = 0;
+
+    context_leave(previous_interpreter);
+}
+
+const char* tlpin_error_message(TlpinError error) {
+    switch (error) {
+    case TLPIN_OK:                    return "OK";
+    case TLPIN_ERROR_DOMAIN:          return "DOMAIN ERROR";
+    case TLPIN_ERROR_SHAPE:           return "SHAPE ERROR";
+    case TLPIN_ERROR_STACK_UNDERFLOW: return "STACK UNDERFLOW";
+    case TLPIN_ERROR_OUT_OF_FUEL:     return "OUT OF FUEL";
+    case TLPIN_ERROR_TIMED_OUT:       return "TIMED OUT";
+    case TLPIN_ERROR_SYNTAX:          return "SYNTAX ERROR";
+    case TLPIN_ERROR_TYPE:            return "TYPE ERROR";
+    case TLPIN_ERROR_INDEX:           return "INDEX ERROR";
+    default:                          assert(0 && "Unreachable");
+    }
+}
+
+void tlpin_destroy(TlpinContext* context) {
+    Interpreter* previous_interpreter = context_enter(context);
+
+    tlpin_stack_clear(context);
+    ARRAY_FREE(&context->stack, &interpreter->allocator);
+    context_program_free(context);
+    (void)pthread_mutex_destroy(&context->interpreter.memo_cache.lock);
+
+    context_leave(previous_interpreter);
+    context->interpreter.allocator.free(context);
+}
+
+bool tlpin_set_thread_count(size_t count) {
+    return thread_pool_set_size(count);
+}
+
+size_t tlpin_thread_count(void) {
+    return thread_pool_size();
+}
+
+
+
+#ifndef TLPIN_LIBRARY
+// Run when no program file is given.
+static const char initial_program[] = "'l' 's' olin o";
+
+int main(int argc, char** argv) {
+    bool        repl              = false;
+    const char* batch_program     = NULL;
+    char**      batch_inputs      = NULL;
+    size_t      batch_input_count = 0;
+    // Runs initial_program if there isn't one.
+    const char* program_path      = NULL;
+
+    for (int i = 1; i < argc; ++i) {
+        if (0 == strcmp(argv[i], "--repl")) {
+            repl = true;
+        } else if (0 == strcmp(argv[i], "--batch") && i + 1 < argc) {
+            // Everything after the program is an input.
+            batch_program     = argv[++i];
+            batch_inputs      = &argv[i + 1];
+            batch_input_count = (size_t)(argc - i - 1);
+            break;
+        } else if (0 == strcmp(argv[i], "--no-jit")) {
+            interpreter->jit_enabled = false;
+        } else if (0 == strcmp(argv[i], "--memoize")) {
+            interpreter->memoize_enabled = true;
+        } else if (0 == strcmp(argv[i], "--lazy")) {
+            interpreter->lazy_enabled = true;
+        } else if (0 == strcmp(argv[i], "--no-quicken")) {
+            interpreter->quicken_enabled = false;
+        } else if (0 == strcmp(argv[i], "--no-dataflow")) {
+            interpreter->dataflow_enabled = false;
+        } else if (0 == strcmp(argv[i], "--threads") && i + 1 < argc) {
+            char* end;
+            long long threads = strtoll(argv[++i], &end, 10);
+            if ('\0' != *end || threads < 0) {
+                (void)fprintf(stderr, "Error: Invalid thread count '%s'\n", argv[i]);
+                return 1;
+            }
+            (void)thread_pool_set_size((size_t)threads);
+        } else if (0 == strcmp(argv[i], "--fuel") && i + 1 < argc) {
+            char* end;
+            interpreter->budget.fuel_limited = true;
+            interpreter->budget.fuel_limit   = strtoll(argv[++i], &end, 10);
+            if ('\0' != *end || interpreter->budget.fuel_limit < 0) {
+                (void)fprintf(stderr, "Error: Invalid fuel amount '%s'\n", argv[i]);
+                return 1;
+            }
+        } else if (0 == strcmp(argv[i], "--timeout") && i + 1 < argc) {
+            char* end;
+            interpreter->budget.time_limited = true;
+            interpreter->budget.time_limit   = strtod(argv[++i], &end);
+            if ( '\0' != *end
+              || !( interpreter->budget.time_limit >= 0
+                 && interpreter->budget.time_limit <= BUDGET_TIME_LIMIT_MAX )) {
+                (void)fprintf(stderr, "Error: Invalid timeout '%s'\n", argv[i]);
+                return 1;
+            }
+        } else if ('-' != argv[i][0] && NULL == program_path) {
+            program_path = argv[i];
+        } else {
+            (void)fprintf(stderr, "Error: Unknown argument '%s'\n", argv[i]);
+            return 1;
+        }
+    }
+
+    if (repl && NULL != program_path) {
+        (void)fprintf(stderr, "Error: '--repl' can't be given a program, but got '%s'\n", program_path);
+        return 1;
+    }
 
-    /* LexemeArray lexemes = lex_program(&contents, SOURCE_FILE, &free, &realloc); */
-    /* sstring_free(&contents, &free); */
+    if (NULL != batch_program) {
+        int status = run_batch(batch_program, batch_inputs, batch_input_count);
+        memo_cache_free();
+        return status;
+    }
 
-    /* dump_lexemes(stdout, &lexemes, SOURCE_FILE); */
-    /* //cparse_program(&lexemes); */
-    /* lexeme_array_free(&lexemes, &free); */
+    if (repl) {
+        Session session = {0};
+        run_repl(&session);
+        session_free(&session);
+        memo_cache_free();
+        return 0;
+    }
 
     ValueArray stack = {0};
+    Program    program;
 
-    FunctionArray program = {0};
-    ARRAY_APPEND_MANY(
-        &program,
-        &array_stdlib_allocator,
-        initial_program,
-        ARRAY_SIZE(initial_program)
-    );
-    /* Value test = { */
-    /*     .type = VALUE_NUMBER, */
-    /*     .as_number = 12 */
-    /* }; */
-    /* ARRAY_APPEND(&program.elements[1].as_literal.as_array, &array_stdlib_allocator, test); */
-    /* ARRAY_APPEND(&program.elements[1].as_literal.as_array, &array_stdlib_allocator, test); */
-    /* ARRAY_APPEND(&program.elements[1].as_literal.as_array, &array_stdlib_allocator, test); */
-    /* ARRAY_APPEND(&program.elements[1].as_literal.as_array, &array_stdlib_allocator, test); */
-    /* ARRAY_APPEND(&program.elements[1].as_literal.as_array, &array_stdlib_allocator, test); */
-    /* ARRAY_APPEND(&program.elements[1].as_literal.as_array, &array_stdlib_allocator, test); */
-    /* ARRAY_APPEND(&program.elements[1].as_literal.as_array, &array_stdlib_allocator, test); */
-    /* ARRAY_APPEND(&program.elements[1].as_literal.as_array, &array_stdlib_allocator, test); */
-    /* ARRAY_APPEND(&program.elements[1].as_literal.as_array, &array_stdlib_allocator, test); */
-    /* ARRAY_APPEND(&program.elements[1].as_literal.as_array, &array_stdlib_allocator, test); */
-
-    Error result = execute_functions(&program, &stack);
-    switch (result) {
-    case ERROR_DOMAIN:          fprintf(stderr, "DOMAIN ERROR\n");     exit(1);
-    case ERROR_SHAPE:           fprintf(stderr, "SHAPE ERROR\n");      exit(1);
-    case ERROR_STACK_UNDERFLOW: fprintf(stderr, "STACK UNDERFLOW\n");  exit(1);
-    case ERROR_OK:     break;
-    default:           assert(0 && "Unreachable");
+    if (NULL != program_path) {
+        if (!compile_file(program_path, &program)) return 1;
+    } else if (!compile_program("<initial>", initial_program, strlen(initial_program), &program)) {
+        return 1;
+    }
+
+    budget_start();
+    Error result = execute_functions(&program.functions, &stack);
+    if (ERROR_OK != result) {
+        (void)fprintf(stderr, "%s\n", error_message(result));
+        exit(1);
     }
 
     (void)printf("Stack dump: ");
-    dump_stack(&stack);
+    dump_stack(stdout, &stack);
 
     // Cleanup.
     for (size_t i = 0; i < stack.count; ++i) {
         value_free(&stack.elements[i]);
     }
-    ARRAY_FREE(&stack, &array_stdlib_allocator);
-    for (size_t i = 0; i < program.count; ++i) {
-        function_free(&program.elements[i]);
+    ARRAY_FREE(&stack, &interpreter->allocator);
+    program_free(&program);
+
+    if (interpreter->memoize_enabled) {
+        (void)fprintf(
+            stderr,
+            "Memoization: %zu hits, %zu misses, %zu cached\n",
+            interpreter->memo_cache.hits, interpreter->memo_cache.misses, interpreter->memo_cache.count
+        );
     }
-    ARRAY_FREE(&program, &array_stdlib_allocator);
+    memo_cache_free();
 
     return 0;
 }
+#endif // TLPIN_LIBRARY
@@ -0,0 +1,137 @@
+/*
+ * libtlpin, for running tlpin programs in-process.
+ *
+ * Each context is a whole interpreter with its own allocator, stack, program,
+ * and limits. Contexts share nothing but the thread pool, so any number of
+ * them can be used at once, as long as each one is only used by one thread at a
+ * time.
+ *
+ * Everything a context allocates goes through its allocator, except for the
+ * thread pool's own bookkeeping, which the contexts share, and the native code
+ * of the JIT, which is mapped straight from the system so it can be executable.
+ *
+ * Like the tlpin command, the library prints a message to stderr and ends the
+ * whole process with exit(1) when an allocation fails, whether that's in the
+ * context's allocator or the thread pool. Syntax errors are reported the same
+ * way as by the command too, by printing where they are to stderr, but only
+ * TLPIN_ERROR_SYNTAX is returned.
+ *
+ * Build with `./build.sh library` to get libtlpin.a and libtlpin.so.
+ */
+
+#ifndef TLPIN_H
+#define TLPIN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define TLPIN_API __attribute__((visibility("default")))
+
+typedef struct TlpinContext TlpinContext;
+
+typedef enum {
+    TLPIN_OK,
+    TLPIN_ERROR_DOMAIN,
+    TLPIN_ERROR_SHAPE,
+    TLPIN_ERROR_STACK_UNDERFLOW,
+    TLPIN_ERROR_OUT_OF_FUEL,
+    TLPIN_ERROR_TIMED_OUT,
+    // The source given to tlpin_compile doesn't compile.
+    TLPIN_ERROR_SYNTAX,
+    // The value asked for is not of the type asked for.
+    TLPIN_ERROR_TYPE,
+    // The index is past the bottom of the stack.
+    TLPIN_ERROR_INDEX
+} TlpinError;
+
+typedef struct {
+    // Used for everything the context allocates. Must be thread-safe, since the
+    // thread pool allocates with it too. Either both are given, or both are
+    // NULL for the C standard library's.
+    void* (*realloc)(void*, size_t);
+    void  (*free)(void*);
+    // How many functions a run may execute, or negative for no limit.
+    int64_t fuel;
+    // How many seconds a run may take, or negative for no limit. Can't be NaN
+    // or more than about 146 years.
+    double  timeout;
+    bool    jit;
+    bool    memoize;
+    bool    lazy;
+    bool    quicken;
+    bool    dataflow;
+} TlpinOptions;
+
+/**
+ * Returns the options the tlpin command uses by default.
+ */
+TLPIN_API TlpinOptions tlpin_options_default(void);
+
+/**
+ * Creates a context with an empty stack and program. Returns NULL if out of
+ * memory, if only one of realloc and free is given, or if the timeout is too
+ * long or NaN.
+ */
+TLPIN_API TlpinContext* tlpin_create(const TlpinOptions* options);
+
+/**
+ * Compiles the source, which uses the same syntax as the REPL, into the
+ * context's program, replacing the previous one. On failure, the previous
+ * program is kept, and what went wrong is printed to stderr.
+ */
+TLPIN_API TlpinError tlpin_compile(TlpinContext* context, const char* source, size_t length);
+
+/**
+ * Runs the program on the context's stack with fresh limits. The stack is kept
+ * between runs.
+ */
+TLPIN_API TlpinError tlpin_run(TlpinContext* context);
+
+TLPIN_API size_t tlpin_stack_count(const TlpinContext* context);
+
+TLPIN_API void tlpin_push_number(TlpinContext* context, double number);
+
+/**
+ * Pushes the string as an array of characters.
+ */
+TLPIN_API void tlpin_push_string(TlpinContext* context, const char* string, size_t length);
+
+/**
+ * Reads the number index values down from the top of the stack, with 0 being
+ * the top.
+ */
+TLPIN_API TlpinError tlpin_get_number(TlpinContext* context, size_t index, double* number);
+
+/**
+ * Reads the array of characters index values down from the top of the stack,
+ * with 0 being the top. Up to size - 1 characters are copied into the buffer,
+ * which is always null terminated if size isn't 0, and the full length of the
+ * string is put in length.
+ */
+TLPIN_API TlpinError tlpin_get_string( TlpinContext* context
+                                     , size_t index
+                                     , char* buffer
+                                     , size_t size
+                                     , size_t* length);
+
+TLPIN_API void tlpin_stack_clear(TlpinContext* context);
+
+TLPIN_API const char* tlpin_error_message(TlpinError error);
+
+TLPIN_API void tlpin_destroy(TlpinContext* context);
+
+/**
+ * Sets how many threads the thread pool shared by all contexts has, including
+ * the thread running a context, with 0 for one per processor, which is the
+ * default. The pool is started by the first run that needs it, after which
+ * the count can't be changed and false is returned.
+ */
+TLPIN_API bool tlpin_set_thread_count(size_t count);
+
+/**
+ * Gets how many threads the thread pool has, or will have once started.
+ */
+TLPIN_API size_t tlpin_thread_count(void);
+
+#endif // TLPIN_H